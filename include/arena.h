@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Records address strings by 32-bit offset, so the arena, and with it the
+   distinct names and addresses of one database, is capped at 4 GiB. Going
+   past that needs wider offsets in dbrecord_t and a new file version. */
+#define STRARENA_MAX UINT32_MAX
+
+typedef struct {
+  uint32_t hash;
+  uint32_t off;
+} strarena_slot_t;
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+  size_t dead;
+  strarena_slot_t *slots;
+  size_t mask;
+  size_t count;
+} strarena_t;
+
+int strarena_reset(strarena_t *arena);
+int strarena_adopt(strarena_t *arena, char *data, size_t len);
+void strarena_free(strarena_t *arena);
+int strarena_reserve(strarena_t *arena, size_t bytes, size_t strings);
+int strarena_intern(strarena_t *arena, const char *str, size_t len,
+                    uint32_t *off);
+bool strarena_valid(const strarena_t *arena, uint32_t off, size_t len);
+
+#endif
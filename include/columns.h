@@ -0,0 +1,15 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t *hours;
+  size_t capacity;
+} dbcolumns_t;
+
+int columns_reserve(dbcolumns_t *cols, size_t capacity);
+void columns_free(dbcolumns_t *cols);
+
+#endif
@@ -7,7 +7,12 @@
 #define STATUS_ERROR -1
 #define STATUS_SUCCESS 0
 
-#define PROTO_VER 100
+#define PROTO_VER_1 100
+#define PROTO_VER_2 200
+#define PROTO_VER PROTO_VER_2
+
+#define BATCH_MAX_BYTES (64 * 1024)
+#define STATS_BUCKETS 16
 
 typedef enum {
   MSG_HELLO_REQ,
@@ -19,6 +24,21 @@ typedef enum {
   MSG_EMPLOYEE_DEL_REQ,
   MSG_EMPLOYEE_DEL_RESP,
   MSG_ERROR,
+  MSG_EMPLOYEE_ADD_BATCH_REQ,
+  MSG_EMPLOYEE_ADD_BATCH_RESP,
+  MSG_EMPLOYEE_STATS_REQ,
+  MSG_EMPLOYEE_STATS_RESP,
+  MSG_EMPLOYEE_QUERY_REQ,
+  MSG_EMPLOYEE_QUERY_RESP,
+  MSG_EMPLOYEE_RANGE_REQ,
+  MSG_EMPLOYEE_RANGE_RESP,
+  MSG_EMPLOYEE_UPDATE_REQ,
+  MSG_EMPLOYEE_UPDATE_RESP,
+  MSG_STATS_REQ,
+  MSG_STATS_RESP,
+  MSG_SAVE_REQ,
+  MSG_SAVE_RESP,
+  MSG_TYPE_COUNT,
 } dbproto_type_e;
 
 typedef struct {
@@ -37,10 +57,56 @@ typedef struct {
 typedef struct {
   u_int8_t data[1024];
 } dbproto_employee_add_req;
-#endif
+
+typedef struct {
+  u_int32_t hours;
+} dbproto_employee_update_req;
+
+typedef struct {
+  u_int32_t size;
+} dbproto_employee_batch_req;
+
+typedef struct {
+  u_int32_t size;
+} dbproto_employee_batch_resp;
+
+typedef struct {
+  u_int32_t bucket_shift;
+} dbproto_employee_stats_req;
+
+typedef struct {
+  u_int64_t sum;
+  u_int32_t count;
+  u_int32_t min;
+  u_int32_t max;
+  u_int32_t bucket_shift;
+  u_int32_t buckets[STATS_BUCKETS];
+} dbproto_employee_stats_resp;
+
+typedef struct {
+  u_int32_t hours_min;
+  u_int32_t hours_max;
+  u_int32_t offset;
+  u_int32_t limit;
+  u_int16_t prefix_len;
+  u_int16_t substring_len;
+} dbproto_employee_query_req;
+
+typedef struct {
+  u_int32_t hours_min;
+  u_int32_t hours_max;
+  u_int32_t limit;
+  u_int32_t descending;
+} dbproto_employee_range_req;
+
+typedef struct {
+  u_int32_t size;
+} dbproto_stats_resp;
 
 typedef struct {
   char name[256];
   char address[256];
   unsigned int hours;
 } dbproto_employee_list_resp;
+
+#endif
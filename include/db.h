@@ -0,0 +1,36 @@
+#ifndef DB_H
+#define DB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+#include "save.h"
+#include "wal.h"
+
+typedef struct {
+  wal_sync_e sync;
+  size_t checkpoint_bytes;
+  bool mmap;
+  bool columnar;
+  bool uring;
+  savepolicy_t save;
+} dbconfig_t;
+
+int db_open(database_t *db, char *filepath, bool newfile,
+            const dbconfig_t *config);
+int db_commit(database_t *db);
+uint64_t db_submit(database_t *db);
+uint64_t db_committed(database_t *db);
+bool db_failed(database_t *db);
+void db_reap(database_t *db);
+int db_commit_fd(database_t *db);
+int db_add_waiter(database_t *db, wal_waiter_t *waiter);
+void db_remove_waiter(database_t *db, wal_waiter_t *waiter);
+bool db_watch(database_t *db, wal_waiter_t *waiter, uint64_t batch);
+bool db_save(database_t *db);
+int db_checkpoint(database_t *db);
+void db_close(database_t *db);
+
+#endif
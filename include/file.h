@@ -3,5 +3,8 @@
 
 int create_db_file(char *filename);
 int open_db_file(char *filename);
+int create_temp_file(const char *filename, char **tmp_path_out);
+int replace_file(const char *from, const char *to);
+int remove_file(const char *path);
 
 #endif
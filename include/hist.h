@@ -0,0 +1,26 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+/* Log-linear latency histogram in the style of HdrHistogram: every power of
+   two is split into 128 linear sub-buckets, so recorded values keep better
+   than 1% precision from 1 ns up to HIST_MAX_BITS. */
+#define HIST_SUB_BITS 8
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) << (HIST_SUB_BITS - 1))
+
+typedef struct {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+} hist_t;
+
+void hist_init(hist_t *hist);
+void hist_record(hist_t *hist, uint64_t value);
+void hist_merge(hist_t *dst, const hist_t *src);
+uint64_t hist_percentile(const hist_t *hist, double percentile);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef HOURSINDEX_H
+#define HOURSINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HOURSINDEX_LEAF 256
+
+struct database;
+
+/* Keys order rows by hours first and row number second, so equal hours stay
+   distinct and a scan can resume from the last key it returned. */
+typedef struct {
+  uint32_t count;
+  uint64_t keys[HOURSINDEX_LEAF];
+} hoursindex_leaf_t;
+
+typedef struct {
+  hoursindex_leaf_t **leaves;
+  size_t nleaves;
+  size_t capacity;
+  size_t count;
+  hoursindex_leaf_t *spare;
+} hoursindex_t;
+
+static inline uint64_t hoursindex_key(uint32_t hours, uint32_t row) {
+  return (uint64_t)hours << 32 | row;
+}
+
+int hoursindex_build(hoursindex_t *index, const struct database *db,
+                     size_t count);
+void hoursindex_free(hoursindex_t *index);
+int hoursindex_reserve(hoursindex_t *index);
+void hoursindex_insert(hoursindex_t *index, uint32_t hours, uint32_t row);
+void hoursindex_remove(hoursindex_t *index, uint32_t hours, uint32_t row);
+size_t hoursindex_scan(const hoursindex_t *index, uint64_t from, uint64_t to,
+                       bool descending, uint64_t *keys, size_t max);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NAMEINDEX_EMPTY UINT32_MAX
+
+struct database;
+
+typedef struct {
+  uint32_t hash;
+  uint32_t row;
+} nameindex_slot_t;
+
+typedef struct {
+  nameindex_slot_t *slots;
+  size_t mask;
+  size_t count;
+} nameindex_t;
+
+int nameindex_build(nameindex_t *index, const struct database *db,
+                    size_t count);
+void nameindex_free(nameindex_t *index);
+int nameindex_insert(nameindex_t *index, const struct database *db,
+                     uint32_t row);
+long nameindex_find(const nameindex_t *index, const struct database *db,
+                    const char *name);
+void nameindex_remove(nameindex_t *index, const struct database *db,
+                      uint32_t row);
+void nameindex_renumber(nameindex_t *index, const char *name, uint32_t from,
+                        uint32_t to);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+typedef enum {
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+} log_level_e;
+
+typedef enum {
+  LOG_FORMAT_TEXT,
+  LOG_FORMAT_JSON,
+} log_format_e;
+
+/* Calls below this level compile away, arguments included. Build with
+   `make LOG_MIN_LEVEL=LOG_LEVEL_DEBUG` to see per-request lines. */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SLOTS 4096
+#define LOG_LINE_MAX 216
+#define LOG_RATE_LIMIT 100
+
+/* Per call site and thread: at most LOG_RATE_LIMIT lines a second. */
+typedef struct {
+  uint64_t second;
+  uint32_t count;
+  uint32_t suppressed;
+} log_limit_t;
+
+#define LOG_AT(level, ...)                                                     \
+  do {                                                                         \
+    if ((level) >= LOG_MIN_LEVEL) {                                            \
+      static __thread log_limit_t log_limit_;                                  \
+      log_write((level), &log_limit_, __FILE__, __LINE__, __VA_ARGS__);        \
+    }                                                                          \
+  } while (0)
+
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+int parse_log_format(const char *arg, log_format_e *format);
+int log_init(log_format_e format);
+void log_shutdown(void);
+void log_detach(void);
+void log_write(log_level_e level, log_limit_t *limit, const char *file,
+               int line, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "hist.h"
+
+#define METRICS_TEXT_MAX (32 * 1024)
+
+typedef enum {
+  METRIC_RECV,
+  METRIC_PARSE,
+  METRIC_COMMIT,
+  METRIC_CHECKPOINT,
+  METRIC_SEND,
+  METRIC_SAVE_PAUSE,
+  METRIC_SAVE,
+  METRIC_PHASES,
+} metric_phase_e;
+
+typedef struct {
+  uint64_t count;
+  uint64_t errors;
+  hist_t latency;
+} metric_t;
+
+/* One slot per reactor thread plus one for the background saver, each
+   written only by its owner. Slots are allocated separately and cache-line
+   aligned so their hot counters never share a line. */
+typedef struct {
+  metric_t messages[MSG_TYPE_COUNT];
+  metric_t phases[METRIC_PHASES];
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t accepted;
+} __attribute__((aligned(64))) metrics_slot_t;
+
+int metrics_init(int nslots);
+void metrics_attach(int slot);
+void metrics_attach_saver(void);
+uint64_t metrics_now(void);
+void metrics_message(u_int16_t type, uint64_t elapsed, bool ok);
+void metrics_phase(metric_phase_e phase, uint64_t elapsed);
+void metrics_bytes_in(size_t bytes);
+void metrics_bytes_out(size_t bytes);
+void metrics_accepted(void);
+size_t metrics_format(char *buf, size_t size);
+int metrics_listen(unsigned short port);
+
+#endif
@@ -1,30 +1,143 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "columns.h"
+#include "hoursindex.h"
+#include "index.h"
+#include "wire.h"
+
 #define HEADER_MAGIC 0x4c4c4144
+#define HEADER_VERSION 3
+#define HEADER_V1_FLAG_NATIVE 0x8000
+#define HEADER_FLAG_NATIVE 0x0001
+/* Two flag bits count snapshots modulo four; see wal_file_hdr_t. */
+#define HEADER_EPOCH_SHIFT 1
+#define HEADER_EPOCH_MASK 0x0006
+#define EPOCH_COUNT 4
+#define EMPLOYEES_MIN_CAPACITY 16
+#define RECORD_STRING_MAX WIRE_FIELD_MAX
+
+typedef struct {
+  const char *ptr;
+  size_t len;
+} span_t;
 
 typedef struct {
   unsigned int magic;
   unsigned short version;
   unsigned short count;
   unsigned int filesize;
-} dbheader_t;
+} dbheader_v1_t;
 
 typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint64_t count;
+  uint64_t filesize;
+  uint32_t record_size;
+  uint32_t checksum;
+} dbheader_v2_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint64_t count;
+  uint64_t filesize;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+  uint32_t record_size;
+  uint32_t checksum;
+} dbheader_t;
+
+/* Version 1 and 2 files store records in this fixed layout. */
+typedef struct employee {
   char name[256];
   char address[256];
   unsigned int hours;
 } employee_t;
 
+typedef struct {
+  uint32_t name_off;
+  uint32_t address_off;
+  uint16_t name_len;
+  uint16_t address_len;
+  uint32_t hours;
+} dbrecord_t;
+
+struct wal;
+struct saver;
+
+typedef struct database {
+  dbheader_t *hdr;
+  dbrecord_t *records;
+  size_t capacity;
+  strarena_t strings;
+  size_t strings_synced;
+  uint64_t records_synced;
+  dbcolumns_t *columns;
+  bool mapped;
+  void *map;
+  size_t map_len;
+  nameindex_t index;
+  hoursindex_t hours;
+  int fd;
+  char *path;
+  struct wal *wal;
+  struct saver *saver;
+  pthread_rwlock_t lock;
+} database_t;
+
+static inline unsigned header_epoch(const dbheader_t *hdr) {
+  return (hdr->flags & HEADER_EPOCH_MASK) >> HEADER_EPOCH_SHIFT;
+}
+
+static inline void set_header_epoch(dbheader_t *hdr, unsigned epoch) {
+  hdr->flags = (hdr->flags & ~HEADER_EPOCH_MASK) |
+               ((epoch % EPOCH_COUNT) << HEADER_EPOCH_SHIFT);
+}
+
+static inline const char *record_name(const database_t *db,
+                                      const dbrecord_t *rec) {
+  return db->strings.data + rec->name_off;
+}
+
+static inline const char *record_address(const database_t *db,
+                                         const dbrecord_t *rec) {
+  return db->strings.data + rec->address_off;
+}
+
 int create_db_header(int fd, dbheader_t **headerOut);
 int validate_db_header(int fd, dbheader_t **headerOut);
-int read_employees(int fd, dbheader_t *, employee_t **employeesOut);
-int output_file(int fd, dbheader_t *, employee_t *employees);
-int add_employee(dbheader_t *dbhdr, employee_t **employees_ptr,
-                 char *addstring);
-int update_working_hours(dbheader_t *dbhdr, employee_t *employees,
-                         char *updatestring);
-int delete_employee(dbheader_t *dbhdr, employee_t **employees_ptr,
-                    char *username);
+int upgrade_db_file(database_t *db);
+int read_employees(database_t *db);
+int output_file(database_t *db);
+int compact_strings_if_needed(database_t *db);
+int sync_mapped_file(database_t *db);
+void unmap_employees(database_t *db);
+bool span_next_field(span_t *input, char sep, span_t *field);
+int span_parse_uint(span_t digits, unsigned int *out);
+int parse_employee_span(span_t input, employee_t *out);
+int parse_update_span(span_t input, span_t *name, unsigned int *hours);
+int parse_employee(char *addstring, employee_t *out);
+int employee_from_wire(const wire_employee_t *in, employee_t *out);
+int make_record(database_t *db, const char *name, size_t name_len,
+                const char *address, size_t address_len, unsigned int hours,
+                dbrecord_t *out);
+int build_columns(database_t *db);
+int reserve_employees(database_t *db, size_t capacity);
+int grow_employees(database_t *db, size_t count);
+int insert_employee(database_t *db, const employee_t *employee);
+int add_employee(database_t *db, char *addstring);
+int set_employee_hours(database_t *db, const char *name, unsigned int hours);
+int update_working_hours(database_t *db, char *updatestring);
+int delete_employee(database_t *db, const char *username);
 
 #endif
@@ -0,0 +1,35 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parse.h"
+
+/* Save once `changes` records have been logged and `seconds` have passed
+   since the last save. No changes means no policy. */
+typedef struct {
+  unsigned int seconds;
+  uint64_t changes;
+} savepolicy_t;
+
+typedef struct saver {
+  database_t *db;
+  savepolicy_t policy;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool requested;
+  bool saving;
+  bool stopping;
+  uint64_t last_save;
+} saver_t;
+
+int parse_save_policy(const char *arg, savepolicy_t *out);
+int saver_start(database_t *db, const savepolicy_t *policy,
+                saver_t **saverOut);
+bool saver_request(saver_t *saver);
+void saver_stop(saver_t *saver);
+
+#endif
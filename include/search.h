@@ -0,0 +1,9 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+const char *find_substring(const char *hay, size_t hay_len, const char *needle,
+                           size_t needle_len);
+
+#endif
@@ -2,11 +2,36 @@
 #define SRVPOLL_H
 
 #include "parse.h"
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
-#define MAX_CLIENTS 256
+#define CLIENT_TABLE_INIT 64
+#define MAX_EVENTS 64
 #define PORT 8080
 #define BUFF_SIZE 4096
+#define RESP_BUFF_SIZE 64
+#define OUT_BUFF_SIZE (64 * 1024)
+#define OUT_HIGH_WATERMARK (OUT_BUFF_SIZE / 2)
+#define LIST_BATCH_RECORDS 64
+
+typedef enum {
+  LIST_BY_ROW,
+  LIST_BY_HOURS_ASC,
+  LIST_BY_HOURS_DESC,
+} listorder_e;
+
+typedef struct {
+  listorder_e order;
+  char prefix[WIRE_FIELD_MAX];
+  char substring[WIRE_FIELD_MAX];
+  u_int16_t prefix_len;
+  u_int16_t substring_len;
+  u_int32_t hours_min;
+  u_int32_t hours_max;
+  uint64_t skip;
+  uint64_t remaining;
+} listquery_t;
 
 typedef enum {
   STATE_NEW,
@@ -16,20 +41,50 @@ typedef enum {
   STATE_DISCONNECTED,
 } state_e;
 
-typedef struct {
+typedef struct clientstate {
   int fd;
   state_e state;
-  unsigned char buffer[BUFF_SIZE];
+  u_int16_t proto;
+  unsigned char *buffer;
+  size_t buffer_size;
   size_t bytes_received;
+  size_t slot;
+  unsigned char *outbuf;
+  size_t out_head;
+  size_t out_len;
+  size_t out_ready;
+  bool listing;
+  uint64_t list_cursor;
+  u_int16_t list_type;
+  listquery_t query;
+  uint64_t commit_batch;
+  bool queued;
+  struct clientstate *next_pending;
+  bool waiting;
+  struct clientstate *wait_prev;
+  struct clientstate *wait_next;
 } clientstate_t;
 
-void handle_client_fsm(dbheader_t *dbhdr, employee_t **employees,
-                       clientstate_t *client, int dbfd);
+typedef struct {
+  clientstate_t **clients;
+  size_t count;
+  size_t capacity;
+} clienttable_t;
+
+void handle_client_fsm(database_t *db, clientstate_t *client);
+
+int flush_client_output(database_t *db, clientstate_t *client);
+
+void release_client_output(clientstate_t *client);
+
+bool client_wants_input(const clientstate_t *client);
+
+int init_client_table(clienttable_t *table, size_t capacity);
 
-void init_clients(clientstate_t *states);
+clientstate_t *acquire_client(clienttable_t *table, int fd);
 
-int find_free_slot(const clientstate_t *states);
+void release_client(clienttable_t *table, clientstate_t *client);
 
-int find_slot_by_fd(const clientstate_t *states, int fd);
+void free_client_table(clienttable_t *table);
 
 #endif
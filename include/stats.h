@@ -0,0 +1,25 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "parse.h"
+
+#define STATS_SHIFT_MAX 31
+
+typedef struct {
+  uint64_t sum;
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t buckets[STATS_BUCKETS];
+} hours_stats_t;
+
+void stats_hours(const uint32_t *hours, size_t count, unsigned int shift,
+                 hours_stats_t *out);
+void stats_records(const dbrecord_t *records, size_t count,
+                   unsigned int shift, hours_stats_t *out);
+
+#endif
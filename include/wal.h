@@ -0,0 +1,112 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+#include "uring.h"
+
+#define WAL_MAGIC 0x57414c47
+#define WAL_VERSION 3
+#define WAL_CHECKPOINT_BYTES (4 * 1024 * 1024)
+#define WAL_IMAGE_MAX (2 * sizeof(uint32_t) + 2 * RECORD_STRING_MAX)
+
+typedef enum {
+  WAL_REC_ADD = 1,
+  WAL_REC_UPDATE,
+  WAL_REC_DELETE,
+} wal_rec_e;
+
+typedef enum {
+  WAL_SYNC_ALWAYS,
+  WAL_SYNC_BATCH,
+  WAL_SYNC_NONE,
+} wal_sync_e;
+
+/* A log only applies on top of the snapshot whose header carries the same
+   epoch. Checkpoints write the database with the next epoch before the log
+   is truncated, so a crash in between cannot replay records twice. */
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t epoch;
+} wal_file_hdr_t;
+
+typedef struct {
+  uint32_t len;
+  uint32_t crc;
+  uint16_t type;
+  uint16_t reserved;
+} wal_rec_hdr_t;
+
+/* A reactor with clients waiting on a batch publishes the oldest one here
+   and has its eventfd signalled once that batch commits or the log fails. */
+typedef struct {
+  int event_fd;
+  uint64_t batch;
+} wal_waiter_t;
+
+typedef struct wal {
+  int fd;
+  char *path;
+  char *rotated_path;
+  bool rotated;
+  uint16_t version;
+  uint16_t epoch;
+  wal_sync_e sync;
+  size_t checkpoint_bytes;
+  uint64_t size;
+  uint64_t records;
+  unsigned char *buf;
+  size_t len;
+  size_t cap;
+  unsigned char *spare;
+  size_t spare_cap;
+  uint64_t next_batch;
+  uint64_t committed;
+  bool failed;
+  uring_t *ring;
+  int event_fd;
+  wal_waiter_t **waiters;
+  size_t nwaiters;
+  unsigned char *inflight;
+  size_t inflight_len;
+  size_t inflight_cap;
+  size_t inflight_done;
+  uint64_t inflight_batch;
+  uint64_t inflight_start;
+  int inflight_cqes;
+  int inflight_error;
+  pthread_mutex_t lock;
+  pthread_mutex_t commit_lock;
+} wal_t;
+
+int wal_open(const char *path, wal_sync_e sync, size_t checkpoint_bytes,
+             bool truncate, unsigned epoch, wal_t **walOut);
+void wal_close(wal_t *wal);
+int wal_replay(wal_t *wal, database_t *db);
+int wal_log_add(wal_t *wal, uint64_t row, const database_t *db,
+                const dbrecord_t *rec);
+int wal_log_update(wal_t *wal, uint64_t row, unsigned int hours);
+int wal_log_delete(wal_t *wal, uint64_t row, uint64_t new_count,
+                   const database_t *db, const dbrecord_t *moved);
+int wal_commit(wal_t *wal);
+int wal_enable_uring(wal_t *wal);
+uint64_t wal_submit(wal_t *wal);
+void wal_reap(wal_t *wal);
+uint64_t wal_committed(wal_t *wal);
+bool wal_failed(wal_t *wal);
+int wal_add_waiter(wal_t *wal, wal_waiter_t *waiter);
+void wal_remove_waiter(wal_t *wal, wal_waiter_t *waiter);
+bool wal_watch(wal_t *wal, wal_waiter_t *waiter, uint64_t batch);
+int wal_reset(wal_t *wal, unsigned epoch);
+int wal_rotate(wal_t *wal);
+int wal_drop_rotated(wal_t *wal);
+uint64_t wal_changes(wal_t *wal);
+bool wal_needs_checkpoint(wal_t *wal);
+int parse_wal_sync(const char *arg, wal_sync_e *out);
+
+#endif
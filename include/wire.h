@@ -0,0 +1,95 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WIRE_VARINT_MAX 5
+#define WIRE_FIELD_MAX 255
+#define WIRE_EMPLOYEE_MAX (3 * WIRE_VARINT_MAX + 2 * WIRE_FIELD_MAX)
+
+typedef struct {
+  const char *name;
+  uint32_t name_len;
+  const char *address;
+  uint32_t address_len;
+  uint32_t hours;
+} wire_employee_t;
+
+static inline size_t wire_varint_size(uint32_t value) {
+  size_t n = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static inline size_t wire_put_varint(uint8_t *out, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+static inline size_t wire_get_varint(const uint8_t *in, size_t avail,
+                                     uint32_t *value) {
+  uint32_t result = 0;
+  for (size_t i = 0; i < avail && i < WIRE_VARINT_MAX; i++) {
+    if (i == WIRE_VARINT_MAX - 1 && in[i] > 0x0f)
+      return 0;
+    result |= (uint32_t)(in[i] & 0x7f) << (7 * i);
+    if ((in[i] & 0x80) == 0) {
+      *value = result;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+static inline size_t wire_employee_size(const wire_employee_t *e) {
+  return wire_varint_size(e->name_len) + e->name_len +
+         wire_varint_size(e->address_len) + e->address_len +
+         wire_varint_size(e->hours);
+}
+
+static inline size_t wire_encode_employee(uint8_t *out,
+                                          const wire_employee_t *e) {
+  size_t n = wire_put_varint(out, e->name_len);
+  memcpy(out + n, e->name, e->name_len);
+  n += e->name_len;
+  n += wire_put_varint(out + n, e->address_len);
+  memcpy(out + n, e->address, e->address_len);
+  n += e->address_len;
+  n += wire_put_varint(out + n, e->hours);
+  return n;
+}
+
+static inline size_t wire_decode_employee(const uint8_t *in, size_t avail,
+                                          wire_employee_t *e) {
+  size_t n, used = 0;
+
+  if ((n = wire_get_varint(in, avail, &e->name_len)) == 0 ||
+      e->name_len > avail - n)
+    return 0;
+  used += n;
+  e->name = (const char *)in + used;
+  used += e->name_len;
+
+  if ((n = wire_get_varint(in + used, avail - used, &e->address_len)) == 0 ||
+      e->address_len > avail - used - n)
+    return 0;
+  used += n;
+  e->address = (const char *)in + used;
+  used += e->address_len;
+
+  if ((n = wire_get_varint(in + used, avail - used, &e->hours)) == 0)
+    return 0;
+  return used + n;
+}
+
+#endif
@@ -0,0 +1,698 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hist.h"
+#include "wire.h"
+
+#define BENCH_MAX_EVENTS 64
+#define BENCH_READ_SIZE (64 * 1024)
+#define BENCH_NAME_MAX 64
+#define BENCH_REQ_MAX                                                          \
+  (sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_update_req) +              \
+   WIRE_EMPLOYEE_MAX)
+#define BENCH_LIST_HEAD                                                        \
+  (sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_batch_resp))
+#define NSEC_PER_SEC 1000000000ull
+
+typedef enum {
+  OP_ADD,
+  OP_LIST,
+  OP_UPDATE,
+  OP_DELETE,
+  OP_COUNT,
+} benchop_e;
+
+static const char *op_names[OP_COUNT] = {"add", "list", "update", "delete"};
+
+typedef struct {
+  struct sockaddr_in addr;
+  unsigned connections;
+  unsigned threads;
+  unsigned duration;
+  unsigned warmup;
+  double rate;
+  unsigned mix[OP_COUNT];
+  unsigned mix_total;
+  unsigned tag;
+} benchconfig_t;
+
+/* Each connection keeps one request in flight. Its employees are named by
+   a sequence number, and [seq_lo, seq_hi) are the ones it has added and not
+   yet deleted, so updates and deletes always target live rows. */
+typedef struct {
+  int fd;
+  unsigned id;
+  bool busy;
+  bool want_out;
+  benchop_e op;
+  uint64_t intended;
+  uint64_t next;
+  uint64_t seq_lo;
+  uint64_t seq_hi;
+  u_int8_t out[BENCH_REQ_MAX];
+  size_t out_len;
+  size_t out_off;
+  u_int8_t head[BENCH_LIST_HEAD];
+  size_t head_len;
+  size_t skip;
+  bool last_frame;
+} benchconn_t;
+
+typedef struct {
+  pthread_t thread;
+  const benchconfig_t *cfg;
+  int epoll_fd;
+  benchconn_t *conns;
+  unsigned nconns;
+  uint64_t start;
+  uint64_t record_from;
+  uint64_t end;
+  uint64_t rng;
+  uint64_t errors;
+  uint64_t lost;
+  hist_t hist[OP_COUNT];
+} benchworker_t;
+
+void print_usage(char *argv[]) {
+  fprintf(stderr, "Usage: %s -h <host> -p <port> [options]\n", argv[0]);
+  fprintf(stderr, "\t-h <host>          (required) Server IPv4 address\n");
+  fprintf(stderr, "\t-p <port>          (required) Server port\n");
+  fprintf(stderr,
+          "\t-c <connections>   Concurrent connections (default 16)\n");
+  fprintf(stderr, "\t-t <threads>       Client threads (default 1)\n");
+  fprintf(stderr, "\t-d <seconds>       Measured duration (default 10)\n");
+  fprintf(stderr, "\t-W <seconds>       Warmup before measuring (default "
+                  "0)\n");
+  fprintf(stderr, "\t-r <requests/s>    Target total rate, 0 runs flat out "
+                  "(default 0)\n");
+  fprintf(stderr, "\t-m <mix>           Request weights (default "
+                  "add=40,list=5,update=40,delete=15)\n");
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static int parse_mix(char *arg, benchconfig_t *cfg) {
+  char *save = NULL;
+
+  memset(cfg->mix, 0, sizeof(cfg->mix));
+  cfg->mix_total = 0;
+
+  for (char *item = strtok_r(arg, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save)) {
+    char *value = strchr(item, '=');
+    char *end;
+    int op;
+
+    if (value == NULL) {
+      return STATUS_ERROR;
+    }
+    *value++ = '\0';
+    for (op = 0; op < OP_COUNT; op++) {
+      if (strcmp(item, op_names[op]) == 0) {
+        break;
+      }
+    }
+    unsigned long weight = strtoul(value, &end, 10);
+    if (op == OP_COUNT || end == value || *end != '\0' || weight > 1000000) {
+      return STATUS_ERROR;
+    }
+    cfg->mix[op] = weight;
+    cfg->mix_total += weight;
+  }
+  return cfg->mix_total > 0 ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+static int read_full(int fd, void *data, size_t size) {
+  size_t total = 0;
+  while (total < size) {
+    ssize_t n = read(fd, (u_int8_t *)data + total, size - total);
+    if (n <= 0) {
+      return STATUS_ERROR;
+    }
+    total += n;
+  }
+  return STATUS_SUCCESS;
+}
+
+static int connect_client(const benchconfig_t *cfg, benchconn_t *conn) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) {
+    perror("socket");
+    return STATUS_ERROR;
+  }
+
+  if (connect(fd, (const struct sockaddr *)&cfg->addr, sizeof(cfg->addr)) ==
+      -1) {
+    perror("connect");
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  int nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  struct {
+    dbproto_hdr_t hdr;
+    dbproto_hello_req hello;
+  } __attribute__((packed)) req;
+  req.hdr.type = htons(MSG_HELLO_REQ);
+  req.hdr.len = htons(1);
+  req.hello.proto = htons(PROTO_VER);
+
+  dbproto_hdr_t resp;
+  dbproto_hello_resp hello;
+  if (write(fd, &req, sizeof(req)) != sizeof(req) ||
+      read_full(fd, &resp, sizeof(resp)) != STATUS_SUCCESS ||
+      ntohs(resp.type) != MSG_HELLO_RESP ||
+      read_full(fd, &hello, sizeof(hello)) != STATUS_SUCCESS) {
+    fprintf(stderr, "Handshake failed on connection %u.\n", conn->id);
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    perror("fcntl");
+    close(fd);
+    return STATUS_ERROR;
+  }
+
+  conn->fd = fd;
+  return STATUS_SUCCESS;
+}
+
+static benchop_e pick_op(benchworker_t *w, const benchconn_t *conn) {
+  unsigned r = next_random(&w->rng) % w->cfg->mix_total;
+  int op = 0;
+
+  while (r >= w->cfg->mix[op]) {
+    r -= w->cfg->mix[op];
+    op++;
+  }
+  if ((op == OP_UPDATE || op == OP_DELETE) && conn->seq_lo == conn->seq_hi) {
+    return OP_ADD;
+  }
+  return op;
+}
+
+static size_t format_name(const benchworker_t *w, const benchconn_t *conn,
+                          uint64_t seq, char *name) {
+  return snprintf(name, BENCH_NAME_MAX, "b%x.%u.%lu", w->cfg->tag, conn->id,
+                  seq);
+}
+
+static void build_request(benchworker_t *w, benchconn_t *conn) {
+  dbproto_hdr_t *hdr = (dbproto_hdr_t *)conn->out;
+  u_int8_t *payload = (u_int8_t *)&hdr[1];
+  char name[BENCH_NAME_MAX];
+  char address[BENCH_NAME_MAX];
+  size_t name_len, size = 0;
+  uint64_t seq;
+
+  switch (conn->op) {
+  case OP_ADD: {
+    seq = conn->seq_hi++;
+    name_len = format_name(w, conn, seq, name);
+    wire_employee_t record = {
+        .name = name,
+        .name_len = name_len,
+        .address = address,
+        .address_len = snprintf(address, sizeof(address), "%lu Bench St", seq),
+        .hours = next_random(&w->rng) % 100};
+    size = wire_encode_employee(payload, &record);
+    hdr->type = htons(MSG_EMPLOYEE_ADD_REQ);
+    hdr->len = htons(size);
+    break;
+  }
+  case OP_LIST:
+    hdr->type = htons(MSG_EMPLOYEE_LIST_REQ);
+    hdr->len = htons(0);
+    break;
+  case OP_UPDATE: {
+    seq = conn->seq_lo +
+          next_random(&w->rng) % (conn->seq_hi - conn->seq_lo);
+    dbproto_employee_update_req req = {
+        .hours = htonl(next_random(&w->rng) % 100)};
+    memcpy(payload, &req, sizeof(req));
+    name_len = format_name(w, conn, seq, name);
+    memcpy(payload + sizeof(req), name, name_len);
+    size = sizeof(req) + name_len;
+    hdr->type = htons(MSG_EMPLOYEE_UPDATE_REQ);
+    hdr->len = htons(name_len);
+    break;
+  }
+  case OP_DELETE:
+    seq = conn->seq_lo++;
+    name_len = format_name(w, conn, seq, name);
+    memcpy(payload, name, name_len);
+    size = name_len;
+    hdr->type = htons(MSG_EMPLOYEE_DEL_REQ);
+    hdr->len = htons(name_len);
+    break;
+  default:
+    break;
+  }
+
+  conn->out_len = sizeof(dbproto_hdr_t) + size;
+  conn->out_off = 0;
+}
+
+static void set_want_out(benchworker_t *w, benchconn_t *conn, bool want) {
+  if (conn->want_out == want) {
+    return;
+  }
+  struct epoll_event ev = {.events = EPOLLIN | (want ? EPOLLOUT : 0),
+                           .data.ptr = conn};
+  epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+  conn->want_out = want;
+}
+
+static void drop_conn(benchworker_t *w, benchconn_t *conn) {
+  if (conn->busy) {
+    w->errors++;
+  }
+  epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  conn->fd = -1;
+  conn->busy = false;
+  w->lost++;
+}
+
+static int send_pending(benchworker_t *w, benchconn_t *conn) {
+  while (conn->out_off < conn->out_len) {
+    ssize_t n = write(conn->fd, conn->out + conn->out_off,
+                      conn->out_len - conn->out_off);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        set_want_out(w, conn, true);
+        return STATUS_SUCCESS;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("write");
+      return STATUS_ERROR;
+    }
+    conn->out_off += n;
+  }
+  set_want_out(w, conn, false);
+  return STATUS_SUCCESS;
+}
+
+static void issue_request(benchworker_t *w, benchconn_t *conn,
+                          uint64_t intended) {
+  conn->op = pick_op(w, conn);
+  conn->intended = intended;
+  conn->busy = true;
+  conn->head_len = 0;
+  conn->skip = 0;
+  conn->last_frame = false;
+  build_request(w, conn);
+  if (send_pending(w, conn) != STATUS_SUCCESS) {
+    drop_conn(w, conn);
+  }
+}
+
+/* Latency runs from the scheduled send time, not the actual one, so a server
+   stall also counts against the requests that queued up behind it. */
+static void complete_request(benchworker_t *w, benchconn_t *conn, bool ok) {
+  uint64_t now = now_ns();
+
+  if (conn->intended >= w->record_from) {
+    hist_record(&w->hist[conn->op], now - conn->intended);
+    if (!ok) {
+      w->errors++;
+    }
+  }
+
+  conn->busy = false;
+  conn->head_len = 0;
+  if (w->cfg->rate > 0) {
+    conn->next = conn->intended +
+                 (uint64_t)(NSEC_PER_SEC * w->cfg->connections / w->cfg->rate);
+  } else {
+    conn->next = now;
+  }
+}
+
+static int consume_input(benchworker_t *w, benchconn_t *conn,
+                         const u_int8_t *data, size_t size) {
+  static const u_int16_t expected[OP_COUNT] = {
+      MSG_EMPLOYEE_ADD_RESP, MSG_EMPLOYEE_LIST_RESP, MSG_EMPLOYEE_UPDATE_RESP,
+      MSG_EMPLOYEE_DEL_RESP};
+  size_t pos = 0;
+
+  while (pos < size) {
+    if (!conn->busy) {
+      fprintf(stderr, "Unexpected data on connection %u.\n", conn->id);
+      return STATUS_ERROR;
+    }
+
+    if (conn->skip > 0) {
+      size_t take = size - pos < conn->skip ? size - pos : conn->skip;
+      conn->skip -= take;
+      pos += take;
+      if (conn->skip == 0 && conn->last_frame) {
+        complete_request(w, conn, true);
+      }
+      continue;
+    }
+
+    size_t need = conn->head_len < sizeof(dbproto_hdr_t)
+                      ? sizeof(dbproto_hdr_t)
+                      : BENCH_LIST_HEAD;
+    size_t take =
+        size - pos < need - conn->head_len ? size - pos : need - conn->head_len;
+    memcpy(conn->head + conn->head_len, data + pos, take);
+    conn->head_len += take;
+    pos += take;
+    if (conn->head_len < need) {
+      continue;
+    }
+
+    const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)conn->head;
+    u_int16_t type = ntohs(hdr->type);
+    if (type != expected[conn->op]) {
+      complete_request(w, conn, false);
+      return STATUS_ERROR;
+    }
+
+    if (conn->op != OP_LIST) {
+      complete_request(w, conn, conn->op == OP_ADD || ntohs(hdr->len) == 1);
+      continue;
+    }
+    if (need == sizeof(dbproto_hdr_t)) {
+      continue;
+    }
+
+    const dbproto_employee_batch_resp *batch =
+        (const dbproto_employee_batch_resp *)&hdr[1];
+    conn->skip = ntohl(batch->size);
+    conn->last_frame = ntohs(hdr->len) == 0;
+    conn->head_len = 0;
+    if (conn->skip == 0 && conn->last_frame) {
+      complete_request(w, conn, true);
+    }
+  }
+  return STATUS_SUCCESS;
+}
+
+static void read_input(benchworker_t *w, benchconn_t *conn, u_int8_t *buf) {
+  while (conn->fd >= 0) {
+    ssize_t n = read(conn->fd, buf, BENCH_READ_SIZE);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0 || consume_input(w, conn, buf, n) != STATUS_SUCCESS) {
+      drop_conn(w, conn);
+      return;
+    }
+  }
+}
+
+static void *run_worker(void *arg) {
+  benchworker_t *w = arg;
+  const benchconfig_t *cfg = w->cfg;
+  struct epoll_event events[BENCH_MAX_EVENTS];
+  uint64_t interval =
+      cfg->rate > 0 ? (uint64_t)(NSEC_PER_SEC * cfg->connections / cfg->rate)
+                    : 0;
+
+  u_int8_t *buf = malloc(BENCH_READ_SIZE);
+  if (buf == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+
+  /* Stagger the schedules so a paced run does not send in bursts. */
+  for (unsigned i = 0; i < w->nconns; i++) {
+    benchconn_t *conn = &w->conns[i];
+    conn->next = w->start + interval * conn->id / cfg->connections;
+  }
+
+  while (1) {
+    uint64_t now = now_ns();
+    if (now >= w->end) {
+      break;
+    }
+
+    uint64_t wake = w->end;
+    for (unsigned i = 0; i < w->nconns; i++) {
+      benchconn_t *conn = &w->conns[i];
+      if (conn->fd < 0 || conn->busy) {
+        continue;
+      }
+      if (conn->next <= now) {
+        issue_request(w, conn, cfg->rate > 0 ? conn->next : now);
+      } else if (conn->next < wake) {
+        wake = conn->next;
+      }
+    }
+
+    /* Sleeps are whole milliseconds, so the last one is spent polling. */
+    int timeout = (wake - now) / 1000000;
+    int n = epoll_wait(w->epoll_fd, events, BENCH_MAX_EVENTS, timeout);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      benchconn_t *conn = events[i].data.ptr;
+      if (conn->fd < 0) {
+        continue;
+      }
+      if ((events[i].events & EPOLLOUT) &&
+          send_pending(w, conn) != STATUS_SUCCESS) {
+        drop_conn(w, conn);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        read_input(w, conn, buf);
+      }
+    }
+  }
+
+  free(buf);
+  return NULL;
+}
+
+static void print_latency(const char *name, const hist_t *hist,
+                          const char *sep) {
+  printf("    \"%s\": {\"count\": %lu, \"mean_us\": %.1f, \"min_us\": %.1f, "
+         "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+         "\"p999_us\": %.1f, \"max_us\": %.1f}%s\n",
+         name, hist->total,
+         hist->total ? hist->sum / 1000.0 / hist->total : 0.0,
+         hist->total ? hist->min / 1000.0 : 0.0,
+         hist_percentile(hist, 50.0) / 1000.0,
+         hist_percentile(hist, 90.0) / 1000.0,
+         hist_percentile(hist, 99.0) / 1000.0,
+         hist_percentile(hist, 99.9) / 1000.0, hist->max / 1000.0, sep);
+}
+
+static void print_report(const benchconfig_t *cfg, benchworker_t *workers,
+                         uint64_t errors, uint64_t lost) {
+  static hist_t ops[OP_COUNT];
+  static hist_t all;
+
+  hist_init(&all);
+  for (int op = 0; op < OP_COUNT; op++) {
+    hist_init(&ops[op]);
+    for (unsigned t = 0; t < cfg->threads; t++) {
+      hist_merge(&ops[op], &workers[t].hist[op]);
+    }
+    hist_merge(&all, &ops[op]);
+  }
+
+  printf("{\n");
+  printf("  \"host\": \"%s\",\n", inet_ntoa(cfg->addr.sin_addr));
+  printf("  \"port\": %u,\n", ntohs(cfg->addr.sin_port));
+  printf("  \"connections\": %u,\n", cfg->connections);
+  printf("  \"threads\": %u,\n", cfg->threads);
+  printf("  \"duration_s\": %u,\n", cfg->duration);
+  printf("  \"warmup_s\": %u,\n", cfg->warmup);
+  printf("  \"target_rps\": %.0f,\n", cfg->rate);
+  printf("  \"mix\": {\"add\": %u, \"list\": %u, \"update\": %u, "
+         "\"delete\": %u},\n",
+         cfg->mix[OP_ADD], cfg->mix[OP_LIST], cfg->mix[OP_UPDATE],
+         cfg->mix[OP_DELETE]);
+  printf("  \"requests\": %lu,\n", all.total);
+  printf("  \"errors\": %lu,\n", errors);
+  printf("  \"connections_lost\": %lu,\n", lost);
+  printf("  \"throughput_rps\": %.1f,\n", (double)all.total / cfg->duration);
+  printf("  \"latency\": {\n");
+  print_latency("all", &all, ",");
+  for (int op = 0; op < OP_COUNT; op++) {
+    print_latency(op_names[op], &ops[op], op + 1 < OP_COUNT ? "," : "");
+  }
+  printf("  }\n");
+  printf("}\n");
+}
+
+int main(int argc, char *argv[]) {
+  char *hostarg = NULL;
+  char mixarg[] = "add=40,list=5,update=40,delete=15";
+  char *mix = mixarg;
+  unsigned short port = 0;
+  benchconfig_t cfg = {.connections = 16, .threads = 1, .duration = 10};
+
+  int c;
+  while ((c = getopt(argc, argv, "h:p:c:t:d:W:r:m:")) != -1) {
+    switch (c) {
+    case 'h':
+      hostarg = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'c':
+      cfg.connections = atoi(optarg);
+      break;
+    case 't':
+      cfg.threads = atoi(optarg);
+      break;
+    case 'd':
+      cfg.duration = atoi(optarg);
+      break;
+    case 'W':
+      cfg.warmup = atoi(optarg);
+      break;
+    case 'r':
+      cfg.rate = atof(optarg);
+      break;
+    case 'm':
+      mix = optarg;
+      break;
+    default:
+      print_usage(argv);
+      return -1;
+    }
+  }
+
+  if (hostarg == NULL || port == 0 || cfg.connections == 0 ||
+      cfg.threads == 0 || cfg.duration == 0 || cfg.rate < 0 ||
+      parse_mix(mix, &cfg) != STATUS_SUCCESS) {
+    print_usage(argv);
+    return -1;
+  }
+  if (cfg.threads > cfg.connections) {
+    cfg.threads = cfg.connections;
+  }
+
+  cfg.addr.sin_family = AF_INET;
+  cfg.addr.sin_addr.s_addr = inet_addr(hostarg);
+  cfg.addr.sin_port = htons(port);
+  cfg.tag = (unsigned)getpid() ^ (unsigned)now_ns();
+
+  benchworker_t *workers = calloc(cfg.threads, sizeof(benchworker_t));
+  benchconn_t *conns = calloc(cfg.connections, sizeof(benchconn_t));
+  if (workers == NULL || conns == NULL) {
+    perror("calloc");
+    return -1;
+  }
+
+  for (unsigned i = 0; i < cfg.connections; i++) {
+    conns[i].id = i;
+    if (connect_client(&cfg, &conns[i]) != STATUS_SUCCESS) {
+      return -1;
+    }
+  }
+
+  uint64_t start = now_ns();
+  unsigned first = 0;
+  for (unsigned t = 0; t < cfg.threads; t++) {
+    benchworker_t *w = &workers[t];
+    w->cfg = &cfg;
+    w->conns = &conns[first];
+    w->nconns = cfg.connections / cfg.threads +
+                (t < cfg.connections % cfg.threads ? 1 : 0);
+    first += w->nconns;
+    w->start = start;
+    w->record_from = start + (uint64_t)cfg.warmup * NSEC_PER_SEC;
+    w->end = w->record_from + (uint64_t)cfg.duration * NSEC_PER_SEC;
+    w->rng = (0x9e3779b97f4a7c15ull * (t + 1)) ^ cfg.tag;
+    for (int op = 0; op < OP_COUNT; op++) {
+      hist_init(&w->hist[op]);
+    }
+
+    w->epoll_fd = epoll_create1(0);
+    if (w->epoll_fd == -1) {
+      perror("epoll_create1");
+      return -1;
+    }
+    for (unsigned i = 0; i < w->nconns; i++) {
+      struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &w->conns[i]};
+      if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->conns[i].fd, &ev) == -1) {
+        perror("epoll_ctl");
+        return -1;
+      }
+    }
+  }
+
+  fprintf(stderr, "Running %u connection(s) on %u thread(s) for %us...\n",
+          cfg.connections, cfg.threads, cfg.warmup + cfg.duration);
+
+  for (unsigned t = 0; t < cfg.threads; t++) {
+    if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) !=
+        0) {
+      perror("pthread_create");
+      return -1;
+    }
+  }
+
+  uint64_t errors = 0, lost = 0;
+  for (unsigned t = 0; t < cfg.threads; t++) {
+    pthread_join(workers[t].thread, NULL);
+    errors += workers[t].errors;
+    lost += workers[t].lost;
+    close(workers[t].epoll_fd);
+  }
+
+  print_report(&cfg, workers, errors, lost);
+
+  for (unsigned i = 0; i < cfg.connections; i++) {
+    if (conns[i].fd >= 0) {
+      close(conns[i].fd);
+    }
+  }
+  free(conns);
+  free(workers);
+  return errors > 0 || lost > 0 ? 1 : 0;
+}
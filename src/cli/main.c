@@ -1,6 +1,8 @@
 #include <arpa/inet.h>
+#include <endian.h>
 #include <bits/getopt_core.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,66 +13,382 @@
 #include <unistd.h>
 
 #include "common.h"
+#include "wire.h"
+
+static int read_full(int fd, void *data, size_t size) {
+  unsigned char *p = data;
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n <= 0) {
+      return STATUS_ERROR;
+    }
+    p += n;
+    size -= n;
+  }
+  return STATUS_SUCCESS;
+}
+
+static int read_employee_stream(int fd, u_int16_t resp_type) {
+  dbproto_hdr_t header;
+  dbproto_hdr_t *hdr = &header;
+  static u_int8_t records[BATCH_MAX_BYTES];
+  bool header_printed = false;
+
+  while (1) {
+    if (read_full(fd, hdr, sizeof(dbproto_hdr_t)) != STATUS_SUCCESS) {
+      printf("Connection lost while listing employees.\n");
+      return STATUS_ERROR;
+    }
+
+    hdr->type = ntohs(hdr->type);
+    hdr->len = ntohs(hdr->len);
+
+    if (hdr->type == MSG_ERROR) {
+      printf("Unable to list employees.\n");
+      close(fd);
+      return STATUS_ERROR;
+    }
+
+    if (hdr->type != resp_type) {
+      printf("Unexpected response type %d while listing.\n", hdr->type);
+      return STATUS_ERROR;
+    }
+
+    if (!header_printed) {
+      printf("Listing employees...\n");
+      header_printed = true;
+    }
+
+    u_int16_t count = hdr->len;
+
+    dbproto_employee_batch_resp batch;
+    if (read_full(fd, &batch, sizeof(batch)) != STATUS_SUCCESS ||
+        ntohl(batch.size) > sizeof(records) ||
+        read_full(fd, records, ntohl(batch.size)) != STATUS_SUCCESS) {
+      printf("Connection lost while listing employees.\n");
+      return STATUS_ERROR;
+    }
+
+    size_t size = ntohl(batch.size);
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+      wire_employee_t employee;
+      size_t n = wire_decode_employee(records + offset, size - offset, &employee);
+      if (n == 0) {
+        printf("Malformed employee record in list response.\n");
+        return STATUS_ERROR;
+      }
+      offset += n;
+      printf("%.*s, %.*s, %u\n", (int)employee.name_len, employee.name,
+             (int)employee.address_len, employee.address, employee.hours);
+    }
+
+    if (count == 0) {
+      break;
+    }
+  }
+
+  return STATUS_SUCCESS;
+}
+
+int employee_stats(int fd, unsigned int shift) {
+  struct {
+    dbproto_hdr_t hdr;
+    dbproto_employee_stats_req req;
+  } request;
+  request.hdr.type = htons(MSG_EMPLOYEE_STATS_REQ);
+  request.hdr.len = htons(1);
+  request.req.bucket_shift = htonl(shift);
+
+  write(fd, &request, sizeof(request));
+
+  dbproto_hdr_t hdr;
+  dbproto_employee_stats_resp stats;
+  if (read_full(fd, &hdr, sizeof(hdr)) != STATUS_SUCCESS) {
+    printf("Connection lost while reading stats.\n");
+    return STATUS_ERROR;
+  }
+
+  if (ntohs(hdr.type) != MSG_EMPLOYEE_STATS_RESP) {
+    printf("Unable to read employee stats.\n");
+    return STATUS_ERROR;
+  }
+
+  if (read_full(fd, &stats, sizeof(stats)) != STATUS_SUCCESS) {
+    printf("Connection lost while reading stats.\n");
+    return STATUS_ERROR;
+  }
+
+  u_int32_t count = ntohl(stats.count);
+  u_int64_t sum = be64toh(stats.sum);
+  printf("Employees: %u\n", count);
+  printf("Total hours: %lu\n", sum);
+  printf("Average hours: %.2f\n", count ? (double)sum / count : 0.0);
+  printf("Min hours: %u\n", ntohl(stats.min));
+  printf("Max hours: %u\n", ntohl(stats.max));
+
+  shift = ntohl(stats.bucket_shift);
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    unsigned long low = (unsigned long)i << shift;
+    if (i == STATS_BUCKETS - 1) {
+      printf("\t%lu+: %u\n", low, ntohl(stats.buckets[i]));
+    } else {
+      printf("\t%lu-%lu: %u\n", low, (((unsigned long)i + 1) << shift) - 1,
+             ntohl(stats.buckets[i]));
+    }
+  }
+  return STATUS_SUCCESS;
+}
 
 int list_employees(int fd) {
-  dbproto_hdr_t buf[4096] = {0};
+  dbproto_hdr_t hdr;
+  hdr.type = htons(MSG_EMPLOYEE_LIST_REQ);
+  hdr.len = htons(0);
 
-  dbproto_hdr_t *hdr = buf;
-  hdr->type = MSG_EMPLOYEE_LIST_REQ;
-  hdr->len = 0;
+  write(fd, &hdr, sizeof(hdr));
 
-  hdr->type = htonl(hdr->type);
-  hdr->len = htons(hdr->len);
+  return read_employee_stream(fd, MSG_EMPLOYEE_LIST_RESP);
+}
 
-  write(fd, buf, sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_add_req));
+int server_metrics(int fd) {
+  dbproto_hdr_t hdr;
+  hdr.type = htons(MSG_STATS_REQ);
+  hdr.len = htons(0);
 
-  read(fd, hdr, sizeof(dbproto_hdr_t));
+  write(fd, &hdr, sizeof(hdr));
 
-  hdr->type = ntohl(hdr->type);
-  hdr->len = ntohs(hdr->len);
+  dbproto_stats_resp stats;
+  if (read_full(fd, &hdr, sizeof(hdr)) != STATUS_SUCCESS) {
+    printf("Connection lost while reading metrics.\n");
+    return STATUS_ERROR;
+  }
 
-  if (hdr->type == MSG_ERROR) {
-    printf("Unable to list employees.\n");
-    close(fd);
+  if (ntohs(hdr.type) != MSG_STATS_RESP) {
+    printf("Unable to read server metrics.\n");
+    return STATUS_ERROR;
+  }
+
+  if (read_full(fd, &stats, sizeof(stats)) != STATUS_SUCCESS) {
+    printf("Connection lost while reading metrics.\n");
+    return STATUS_ERROR;
+  }
+
+  size_t size = ntohl(stats.size);
+  char *text = malloc(size);
+  if (text == NULL) {
+    perror("malloc");
+    return STATUS_ERROR;
+  }
+  if (read_full(fd, text, size) != STATUS_SUCCESS) {
+    printf("Connection lost while reading metrics.\n");
+    free(text);
+    return STATUS_ERROR;
+  }
+
+  fwrite(text, 1, size, stdout);
+  free(text);
+  return STATUS_SUCCESS;
+}
+
+int save_database(int fd) {
+  dbproto_hdr_t hdr;
+  hdr.type = htons(MSG_SAVE_REQ);
+  hdr.len = htons(0);
+
+  write(fd, &hdr, sizeof(hdr));
+
+  if (read_full(fd, &hdr, sizeof(hdr)) != STATUS_SUCCESS) {
+    printf("Connection lost while requesting a save.\n");
+    return STATUS_ERROR;
+  }
+
+  if (ntohs(hdr.type) != MSG_SAVE_RESP) {
+    printf("Unable to request a save.\n");
+    return STATUS_ERROR;
+  }
+
+  if (ntohs(hdr.len) > 0) {
+    printf("Background save started.\n");
+  } else {
+    printf("Background save already in progress.\n");
+  }
+  return STATUS_SUCCESS;
+}
+
+static int parse_query_uint(const char *field, u_int32_t fallback,
+                            u_int32_t *out) {
+  char *end;
+
+  if (*field == '\0') {
+    *out = fallback;
+    return STATUS_SUCCESS;
+  }
+  unsigned long value = strtoul(field, &end, 10);
+  if (*end != '\0' || value > UINT32_MAX) {
     return STATUS_ERROR;
   }
+  *out = value;
+  return STATUS_SUCCESS;
+}
 
-  if (hdr->type == MSG_EMPLOYEE_LIST_RESP) {
-    printf("Listing employees...\n");
-    dbproto_employee_list_resp *employee =
-        (dbproto_employee_list_resp *)&hdr[1];
+int query_employees(int fd, char *queryarg) {
+  char *fields[6] = {"", "", "", "", "", ""};
+  int nfields = 0;
+  char *rest = queryarg;
 
-    for (int i = 0; i < hdr->len; i++) {
-      read(fd, employee, sizeof(dbproto_employee_list_resp));
-      employee->hours = ntohl(employee->hours);
-      printf("%s, %s, %d\n", employee->name, employee->address,
-             employee->hours);
+  while (rest != NULL && nfields < 6) {
+    fields[nfields++] = rest;
+    rest = strchr(rest, ',');
+    if (rest != NULL) {
+      *rest++ = '\0';
     }
   }
 
+  size_t prefix_len = strlen(fields[0]);
+  size_t substring_len = strlen(fields[1]);
+  struct {
+    dbproto_hdr_t hdr;
+    dbproto_employee_query_req req;
+    char strings[2 * WIRE_FIELD_MAX];
+  } request;
+  u_int32_t hours_min, hours_max, offset, limit;
+
+  if (rest != NULL || prefix_len > WIRE_FIELD_MAX ||
+      substring_len > WIRE_FIELD_MAX ||
+      parse_query_uint(fields[2], 0, &hours_min) != STATUS_SUCCESS ||
+      parse_query_uint(fields[3], UINT32_MAX, &hours_max) != STATUS_SUCCESS ||
+      parse_query_uint(fields[4], 0, &offset) != STATUS_SUCCESS ||
+      parse_query_uint(fields[5], 0, &limit) != STATUS_SUCCESS) {
+    printf("Improper format for query string.\n");
+    return STATUS_ERROR;
+  }
+
+  request.hdr.type = htons(MSG_EMPLOYEE_QUERY_REQ);
+  request.hdr.len = htons(1);
+  request.req.hours_min = htonl(hours_min);
+  request.req.hours_max = htonl(hours_max);
+  request.req.offset = htonl(offset);
+  request.req.limit = htonl(limit);
+  request.req.prefix_len = htons(prefix_len);
+  request.req.substring_len = htons(substring_len);
+  memcpy(request.strings, fields[0], prefix_len);
+  memcpy(request.strings + prefix_len, fields[1], substring_len);
+
+  write(fd, &request,
+        sizeof(request.hdr) + sizeof(request.req) + prefix_len +
+            substring_len);
+
+  return read_employee_stream(fd, MSG_EMPLOYEE_QUERY_RESP);
+}
+
+static int send_range(int fd, u_int32_t hours_min, u_int32_t hours_max,
+                      u_int32_t limit, bool descending) {
+  struct {
+    dbproto_hdr_t hdr;
+    dbproto_employee_range_req req;
+  } request;
+
+  request.hdr.type = htons(MSG_EMPLOYEE_RANGE_REQ);
+  request.hdr.len = htons(1);
+  request.req.hours_min = htonl(hours_min);
+  request.req.hours_max = htonl(hours_max);
+  request.req.limit = htonl(limit);
+  request.req.descending = htonl(descending);
+
+  write(fd, &request, sizeof(request));
+
+  return read_employee_stream(fd, MSG_EMPLOYEE_RANGE_RESP);
+}
+
+int range_employees(int fd, char *rangearg) {
+  char *fields[3] = {"", "", ""};
+  int nfields = 0;
+  char *rest = rangearg;
+
+  while (rest != NULL && nfields < 3) {
+    fields[nfields++] = rest;
+    rest = strchr(rest, ',');
+    if (rest != NULL) {
+      *rest++ = '\0';
+    }
+  }
+
+  u_int32_t hours_min, hours_max, limit;
+
+  if (rest != NULL ||
+      parse_query_uint(fields[0], 0, &hours_min) != STATUS_SUCCESS ||
+      parse_query_uint(fields[1], UINT32_MAX, &hours_max) != STATUS_SUCCESS ||
+      parse_query_uint(fields[2], 0, &limit) != STATUS_SUCCESS) {
+    printf("Improper format for range string.\n");
+    return STATUS_ERROR;
+  }
+
+  return send_range(fd, hours_min, hours_max, limit, false);
+}
+
+int top_employees(int fd, const char *toparg) {
+  u_int32_t limit;
+
+  if (*toparg == '\0' ||
+      parse_query_uint(toparg, 0, &limit) != STATUS_SUCCESS || limit == 0) {
+    printf("Improper count for top employees.\n");
+    return STATUS_ERROR;
+  }
+
+  return send_range(fd, 0, UINT32_MAX, limit, true);
+}
+
+static int parse_employee_line(char *line, wire_employee_t *out) {
+  line[strcspn(line, "\r\n")] = '\0';
+  char *address = strchr(line, ',');
+  char *hours = address ? strchr(address + 1, ',') : NULL;
+  char *end;
+
+  if (hours == NULL) {
+    return STATUS_ERROR;
+  }
+  *address++ = '\0';
+  *hours++ = '\0';
+
+  unsigned long value = strtoul(hours, &end, 10);
+  if (*line == '\0' || end == hours || *end != '\0' || value > UINT32_MAX ||
+      strlen(line) > WIRE_FIELD_MAX || strlen(address) > WIRE_FIELD_MAX) {
+    return STATUS_ERROR;
+  }
+
+  out->name = line;
+  out->name_len = strlen(line);
+  out->address = address;
+  out->address_len = strlen(address);
+  out->hours = value;
   return STATUS_SUCCESS;
 }
 
 int send_employee(int fd, char *addstr) {
   dbproto_hdr_t buf[4096] = {0};
+  char line[1024];
+  wire_employee_t record;
 
-  dbproto_hdr_t *hdr = buf;
-  hdr->type = MSG_EMPLOYEE_ADD_REQ;
-  hdr->len = 1;
-
-  dbproto_employee_add_req *employee = (dbproto_employee_add_req *)&hdr[1];
-  strncpy((char *)&employee->data, addstr, sizeof(employee->data));
-
-  employee->data[sizeof(employee->data) - 1] = '\0';
+  strncpy(line, addstr, sizeof(line) - 1);
+  line[sizeof(line) - 1] = '\0';
+  if (parse_employee_line(line, &record) != STATUS_SUCCESS) {
+    printf("Improper format for add employee string.\n");
+    return STATUS_ERROR;
+  }
 
-  hdr->type = htons(hdr->type);
-  hdr->len = htons(hdr->len);
+  dbproto_hdr_t *hdr = buf;
+  size_t size = wire_encode_employee((u_int8_t *)&hdr[1], &record);
+  hdr->type = htons(MSG_EMPLOYEE_ADD_REQ);
+  hdr->len = htons(size);
 
-  write(fd, buf, sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_add_req));
+  write(fd, buf, sizeof(dbproto_hdr_t) + size);
 
-  read(fd, buf, sizeof(buf));
+  if (read_full(fd, hdr, sizeof(dbproto_hdr_t)) != STATUS_SUCCESS) {
+    printf("Connection lost while adding employee.\n");
+    return STATUS_ERROR;
+  }
 
-  hdr->type = ntohl(hdr->type);
+  hdr->type = ntohs(hdr->type);
   hdr->len = ntohs(hdr->len);
 
   if (hdr->type == MSG_ERROR) {
@@ -86,6 +404,189 @@ int send_employee(int fd, char *addstr) {
   return STATUS_SUCCESS;
 }
 
+static int send_batch(int fd, u_int8_t *frame, size_t size, u_int16_t count,
+                      size_t *added) {
+  dbproto_hdr_t *hdr = (dbproto_hdr_t *)frame;
+  dbproto_employee_batch_req *req = (dbproto_employee_batch_req *)&hdr[1];
+  size_t frame_size = sizeof(dbproto_hdr_t) + sizeof(*req) + size;
+
+  hdr->type = htons(MSG_EMPLOYEE_ADD_BATCH_REQ);
+  hdr->len = htons(count);
+  req->size = htonl(size);
+
+  if (write(fd, frame, frame_size) != (ssize_t)frame_size) {
+    perror("write");
+    return STATUS_ERROR;
+  }
+
+  dbproto_hdr_t resp;
+  if (read_full(fd, &resp, sizeof(resp)) != STATUS_SUCCESS) {
+    printf("Connection lost while adding employees.\n");
+    return STATUS_ERROR;
+  }
+
+  if (ntohs(resp.type) != MSG_EMPLOYEE_ADD_BATCH_RESP ||
+      ntohs(resp.len) != count) {
+    printf("Server rejected employee batch.\n");
+    return STATUS_ERROR;
+  }
+
+  u_int8_t bitmap[(UINT16_MAX + 8) / 8];
+  if (read_full(fd, bitmap, (count + 7) / 8) != STATUS_SUCCESS) {
+    printf("Connection lost while adding employees.\n");
+    return STATUS_ERROR;
+  }
+
+  for (u_int16_t i = 0; i < count; i++) {
+    if (bitmap[i / 8] & (1 << (i % 8))) {
+      (*added)++;
+    }
+  }
+  return STATUS_SUCCESS;
+}
+
+int send_employee_file(int fd, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("fopen");
+    return STATUS_ERROR;
+  }
+
+  size_t prefix = sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_batch_req);
+  u_int8_t *frame = malloc(prefix + BATCH_MAX_BYTES);
+  if (frame == NULL) {
+    perror("malloc");
+    fclose(file);
+    return STATUS_ERROR;
+  }
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  size_t size = 0, sent = 0, added = 0, skipped = 0;
+  u_int16_t count = 0;
+  int ret = STATUS_SUCCESS;
+
+  while (getline(&line, &line_cap, file) != -1) {
+    wire_employee_t record;
+    if (parse_employee_line(line, &record) != STATUS_SUCCESS) {
+      skipped++;
+      continue;
+    }
+    size_t record_size = wire_employee_size(&record);
+    if (record_size > BATCH_MAX_BYTES) {
+      skipped++;
+      continue;
+    }
+
+    if (size + record_size > BATCH_MAX_BYTES || count == UINT16_MAX) {
+      if (send_batch(fd, frame, size, count, &added) != STATUS_SUCCESS) {
+        ret = STATUS_ERROR;
+        break;
+      }
+      sent += count;
+      size = 0;
+      count = 0;
+    }
+
+    size += wire_encode_employee(frame + prefix + size, &record);
+    count++;
+  }
+
+  if (ret == STATUS_SUCCESS && count > 0) {
+    if (send_batch(fd, frame, size, count, &added) != STATUS_SUCCESS) {
+      ret = STATUS_ERROR;
+    } else {
+      sent += count;
+    }
+  }
+
+  printf("Added %zu of %zu employees (%zu malformed lines skipped).\n", added,
+         sent, skipped);
+
+  free(line);
+  free(frame);
+  fclose(file);
+  return ret;
+}
+
+static int send_change(int fd, u_int16_t type, u_int16_t resp_type,
+                       const void *payload, size_t payload_size,
+                       const char *name) {
+  u_int8_t frame[sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_update_req) +
+                 WIRE_FIELD_MAX];
+  size_t name_len = strlen(name);
+
+  if (name_len == 0 || name_len > WIRE_FIELD_MAX) {
+    printf("Improper employee name.\n");
+    return STATUS_ERROR;
+  }
+
+  dbproto_hdr_t *hdr = (dbproto_hdr_t *)frame;
+  hdr->type = htons(type);
+  hdr->len = htons(name_len);
+  if (payload_size > 0) {
+    memcpy(&hdr[1], payload, payload_size);
+  }
+  memcpy((u_int8_t *)&hdr[1] + payload_size, name, name_len);
+
+  size_t frame_size = sizeof(dbproto_hdr_t) + payload_size + name_len;
+  if (write(fd, frame, frame_size) != (ssize_t)frame_size) {
+    perror("write");
+    return STATUS_ERROR;
+  }
+
+  dbproto_hdr_t resp;
+  if (read_full(fd, &resp, sizeof(resp)) != STATUS_SUCCESS) {
+    printf("Connection lost while changing employee.\n");
+    return STATUS_ERROR;
+  }
+
+  if (ntohs(resp.type) != resp_type) {
+    printf("Server rejected the request.\n");
+    return STATUS_ERROR;
+  }
+
+  if (ntohs(resp.len) == 0) {
+    printf("Employee '%s' not found.\n", name);
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+int update_employee(int fd, char *updatearg) {
+  char *hours = strrchr(updatearg, ',');
+  u_int32_t value;
+
+  if (hours == NULL) {
+    printf("Improper format for update string.\n");
+    return STATUS_ERROR;
+  }
+  *hours++ = '\0';
+  if (*hours == '\0' || parse_query_uint(hours, 0, &value) != STATUS_SUCCESS) {
+    printf("Improper format for update string.\n");
+    return STATUS_ERROR;
+  }
+
+  dbproto_employee_update_req req = {.hours = htonl(value)};
+  if (send_change(fd, MSG_EMPLOYEE_UPDATE_REQ, MSG_EMPLOYEE_UPDATE_RESP, &req,
+                  sizeof(req), updatearg) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  printf("Employee succesfully updated.\n");
+  return STATUS_SUCCESS;
+}
+
+int delete_employee(int fd, const char *name) {
+  if (send_change(fd, MSG_EMPLOYEE_DEL_REQ, MSG_EMPLOYEE_DEL_RESP, NULL, 0,
+                  name) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  printf("Employee succesfully deleted.\n");
+  return STATUS_SUCCESS;
+}
+
 int send_hello(int fd) {
   dbproto_hdr_t buf[4096] = {0};
 
@@ -94,18 +595,21 @@ int send_hello(int fd) {
   hdr->len = 1;
 
   dbproto_hello_req *hello = (dbproto_hello_req *)&hdr[1];
-  hello->proto = htons(hello->proto);
+  hello->proto = PROTO_VER;
 
-  hdr->type = htonl(hdr->type);
+  hdr->type = htons(hdr->type);
   hdr->len = htons(hdr->len);
   hello->proto = htons(hello->proto);
 
   write(fd, buf, sizeof(dbproto_hdr_t) + sizeof(dbproto_hello_req));
 
-  read(fd, buf, sizeof(buf));
+  if (read_full(fd, hdr, sizeof(dbproto_hdr_t)) != STATUS_SUCCESS) {
+    printf("Connection lost during handshake.\n");
+    return STATUS_ERROR;
+  }
 
-  hdr->type = ntohl(hdr->type);
-  hdr->type = ntohl(hdr->len);
+  hdr->type = ntohs(hdr->type);
+  hdr->len = ntohs(hdr->len);
 
   if (hdr->type == MSG_ERROR) {
     printf("Protocol mismatch.\n");
@@ -113,25 +617,69 @@ int send_hello(int fd) {
     return STATUS_ERROR;
   }
 
-  printf("Server connected, protocol v1.\n");
+  dbproto_hello_resp *resp = (dbproto_hello_resp *)&hdr[1];
+  if (read_full(fd, resp, sizeof(dbproto_hello_resp)) != STATUS_SUCCESS) {
+    printf("Connection lost during handshake.\n");
+    return STATUS_ERROR;
+  }
+
+  printf("Server connected, protocol v%d.\n", ntohs(resp->proto));
   return STATUS_SUCCESS;
 }
 
 int main(int argc, char *argv[]) {
   char *addarg = NULL;
+  char *filearg = NULL;
+  char *queryarg = NULL;
+  char *rangearg = NULL;
+  char *updatearg = NULL;
+  char *deletearg = NULL;
+  char *toparg = NULL;
   char *portarg = NULL, *hostarg = NULL;
   unsigned short port = 0;
   bool list = false;
+  bool stats = false;
+  bool metrics = false;
+  bool save = false;
+  unsigned int shift = 0;
 
   int c;
-  while ((c = getopt(argc, argv, "p:h:a:l")) != -1) {
+  while ((c = getopt(argc, argv, "p:h:a:A:u:d:ls:q:r:k:MS")) != -1) {
     switch (c) {
     case 'a':
       addarg = optarg;
       break;
+    case 'A':
+      filearg = optarg;
+      break;
+    case 'u':
+      updatearg = optarg;
+      break;
+    case 'd':
+      deletearg = optarg;
+      break;
     case 'l':
       list = true;
       break;
+    case 's':
+      stats = true;
+      shift = atoi(optarg);
+      break;
+    case 'q':
+      queryarg = optarg;
+      break;
+    case 'M':
+      metrics = true;
+      break;
+    case 'S':
+      save = true;
+      break;
+    case 'r':
+      rangearg = optarg;
+      break;
+    case 'k':
+      toparg = optarg;
+      break;
     case 'p':
       portarg = optarg;
       port = atoi(portarg);
@@ -174,6 +722,9 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  int nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
   if (send_hello(fd) != STATUS_SUCCESS) {
     return -1;
   }
@@ -182,9 +733,45 @@ int main(int argc, char *argv[]) {
     send_employee(fd, addarg);
   }
 
+  if (filearg) {
+    send_employee_file(fd, filearg);
+  }
+
+  if (updatearg) {
+    update_employee(fd, updatearg);
+  }
+
+  if (deletearg) {
+    delete_employee(fd, deletearg);
+  }
+
   if (list) {
     list_employees(fd);
   }
 
+  if (queryarg) {
+    query_employees(fd, queryarg);
+  }
+
+  if (rangearg) {
+    range_employees(fd, rangearg);
+  }
+
+  if (toparg) {
+    top_employees(fd, toparg);
+  }
+
+  if (stats) {
+    employee_stats(fd, shift);
+  }
+
+  if (metrics) {
+    server_metrics(fd);
+  }
+
+  if (save) {
+    save_database(fd);
+  }
+
   close(fd);
 }
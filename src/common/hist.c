@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "hist.h"
+
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_VALUE_MAX ((1ull << HIST_MAX_BITS) - 1)
+
+static unsigned bucket_index(uint64_t value) {
+  if (value < HIST_SUB) {
+    return value;
+  }
+  unsigned shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS - 1);
+  return shift * HIST_HALF + (unsigned)(value >> shift);
+}
+
+/* Smallest value that lands in the bucket. */
+static uint64_t bucket_value(unsigned index) {
+  if (index < HIST_SUB) {
+    return index;
+  }
+  unsigned shift = index / HIST_HALF - 1;
+  return (uint64_t)(index % HIST_HALF + HIST_HALF) << shift;
+}
+
+/* Each histogram has a single writer. Relaxed loads and stores let other
+   threads read it while it is being updated, without locked instructions. */
+static inline void add_relaxed(uint64_t *counter, uint64_t value) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                   __ATOMIC_RELAXED);
+}
+
+static inline uint64_t load_relaxed(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void hist_init(hist_t *hist) {
+  memset(hist, 0, sizeof(*hist));
+  hist->min = UINT64_MAX;
+}
+
+void hist_record(hist_t *hist, uint64_t value) {
+  if (value > HIST_VALUE_MAX) {
+    value = HIST_VALUE_MAX;
+  }
+  add_relaxed(&hist->counts[bucket_index(value)], 1);
+  add_relaxed(&hist->total, 1);
+  add_relaxed(&hist->sum, value);
+  if (value < hist->min) {
+    __atomic_store_n(&hist->min, value, __ATOMIC_RELAXED);
+  }
+  if (value > hist->max) {
+    __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+  }
+}
+
+void hist_merge(hist_t *dst, const hist_t *src) {
+  for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+    dst->counts[i] += load_relaxed(&src->counts[i]);
+  }
+  dst->total += load_relaxed(&src->total);
+  dst->sum += load_relaxed(&src->sum);
+  uint64_t min = load_relaxed(&src->min);
+  uint64_t max = load_relaxed(&src->max);
+  if (min < dst->min) {
+    dst->min = min;
+  }
+  if (max > dst->max) {
+    dst->max = max;
+  }
+}
+
+/* Reports the highest value equivalent to the bucket holding the rank, as
+   HdrHistogram does, capped at the largest value actually recorded. */
+uint64_t hist_percentile(const hist_t *hist, double percentile) {
+  if (hist->total == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(percentile / 100.0 * hist->total + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->counts[i];
+    if (seen >= rank) {
+      uint64_t value = i + 1 < HIST_BUCKETS ? bucket_value(i + 1) - 1
+                                            : HIST_VALUE_MAX;
+      return value < hist->max ? value : hist->max;
+    }
+  }
+  return hist->max;
+}
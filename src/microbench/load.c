@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "db.h"
+#include "parse.h"
+
+#define NSEC_PER_SEC 1000000000ull
+#define COMMIT_EVERY 4096
+#define LOOKUPS 100000
+
+static FILE *report;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static double seconds(uint64_t ns) { return (double)ns / NSEC_PER_SEC; }
+
+static void print_usage(char *argv[]) {
+  fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+  fprintf(stderr, "\t-n <records>       Employees to load (default "
+                  "2000000)\n");
+  fprintf(stderr, "\t-f <database file> Database to create (default "
+                  "bench_load.db)\n");
+  fprintf(stderr, "\t-k                 Keep the database afterwards\n");
+}
+
+static void make_employee(uint64_t i, employee_t *employee) {
+  snprintf(employee->name, sizeof(employee->name), "e%lu", i);
+  snprintf(employee->address, sizeof(employee->address), "%lu Main St",
+           i % 1000);
+  employee->hours = i % 80;
+}
+
+/* Adds every employee through the ADD path, committing the log in batches
+   as the reactors do, and leaves the checkpoint to db_close(). */
+static int create_file(char *path, uint64_t records,
+                       const dbconfig_t *config) {
+  database_t db = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+  employee_t employee = {0};
+  uint64_t loaded = 0;
+  int ret = STATUS_ERROR;
+
+  uint64_t start = now_ns();
+  if (db_open(&db, path, true, config) != STATUS_SUCCESS) {
+    goto out;
+  }
+  for (uint64_t i = 0; i < records; i++) {
+    make_employee(i, &employee);
+    if (insert_employee(&db, &employee) != STATUS_SUCCESS ||
+        ((i + 1) % COMMIT_EVERY == 0 && db_commit(&db) != STATUS_SUCCESS)) {
+      goto out;
+    }
+  }
+  if (db_commit(&db) != STATUS_SUCCESS) {
+    goto out;
+  }
+  loaded = now_ns();
+  fprintf(report, "  \"insert_s\": %.3f,\n", seconds(loaded - start));
+  ret = STATUS_SUCCESS;
+
+out:
+  db_close(&db);
+  if (ret == STATUS_SUCCESS) {
+    fprintf(report, "  \"checkpoint_s\": %.3f,\n", seconds(now_ns() - loaded));
+  }
+  return ret;
+}
+
+/* Reopens the file, checks the record count and looks up a spread of
+   names, verifying the hours stored with each. */
+static int reopen_file(char *path, uint64_t records,
+                       const dbconfig_t *config, const char *mode) {
+  database_t db = {.lock = PTHREAD_RWLOCK_INITIALIZER};
+  employee_t employee;
+  int ret = STATUS_ERROR;
+
+  uint64_t start = now_ns();
+  if (db_open(&db, path, false, config) != STATUS_SUCCESS) {
+    goto out;
+  }
+  uint64_t opened = now_ns();
+
+  if (db.hdr->count != records) {
+    fprintf(stderr, "%s: expected %lu records, found %lu\n", mode, records,
+            db.hdr->count);
+    goto out;
+  }
+
+  uint64_t lookups = records < LOOKUPS ? records : LOOKUPS;
+  for (uint64_t i = 0; i < lookups; i++) {
+    uint64_t row = i * (records / lookups);
+    make_employee(row, &employee);
+    long index = nameindex_find(&db.index, &db, employee.name);
+    if (index < 0 || db.records[index].hours != employee.hours) {
+      fprintf(stderr, "%s: employee '%s' missing or wrong\n", mode,
+              employee.name);
+      goto out;
+    }
+  }
+  uint64_t looked_up = now_ns();
+
+  fprintf(report, "  \"%s\": {\"open_s\": %.3f, \"lookup_ns\": %.1f},\n",
+          mode, seconds(opened - start),
+          (double)(looked_up - opened) / lookups);
+  ret = STATUS_SUCCESS;
+
+out:
+  db_close(&db);
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  char default_path[] = "bench_load.db";
+  char *path = default_path;
+  uint64_t records = 2000000;
+  bool keep = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:f:k")) != -1) {
+    switch (c) {
+    case 'n':
+      records = strtoull(optarg, NULL, 10);
+      break;
+    case 'f':
+      path = optarg;
+      break;
+    case 'k':
+      keep = true;
+      break;
+    default:
+      print_usage(argv);
+      return -1;
+    }
+  }
+
+  if (records == 0 || records >= NAMEINDEX_EMPTY) {
+    print_usage(argv);
+    return -1;
+  }
+
+  char wal_path[PATH_MAX];
+  snprintf(wal_path, sizeof(wal_path), "%s.wal", path);
+  unlink(path);
+  unlink(wal_path);
+
+  /* The server logs info lines to stdout; send them to stderr so stdout
+     carries only the report. */
+  report = fdopen(dup(STDOUT_FILENO), "w");
+  if (report == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+    perror("dup");
+    return -1;
+  }
+
+  dbconfig_t config = {.sync = WAL_SYNC_NONE, .checkpoint_bytes = SIZE_MAX};
+  int ret = -1;
+
+  fprintf(report, "{\n");
+  fprintf(report, "  \"records\": %lu,\n", records);
+  if (create_file(path, records, &config) != STATUS_SUCCESS) {
+    goto out;
+  }
+
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    perror("stat");
+    goto out;
+  }
+  fprintf(report, "  \"file_bytes\": %ld,\n", (long)st.st_size);
+
+  if (reopen_file(path, records, &config, "heap") != STATUS_SUCCESS) {
+    goto out;
+  }
+  config.mmap = true;
+  if (reopen_file(path, records, &config, "mmap") != STATUS_SUCCESS) {
+    goto out;
+  }
+  ret = 0;
+
+out:
+  fprintf(report, "  \"ok\": %s\n", ret == 0 ? "true" : "false");
+  fprintf(report, "}\n");
+  fclose(report);
+  if (!keep) {
+    unlink(path);
+    unlink(wal_path);
+  }
+  return ret;
+}
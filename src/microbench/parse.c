@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "parse.h"
+
+#define NSEC_PER_SEC 1000000000ull
+#define INPUT_MAX 1024
+#define TIMED_RECORDS 65536
+#define EXAMPLES_MAX 5
+
+/* Reasons the span parser is allowed to disagree with the strtok one. */
+typedef enum {
+  DIFF_EMPTY_FIELD,
+  DIFF_LONG_FIELD,
+  DIFF_HOURS_SPACE,
+  DIFF_HOURS_SIGN,
+  DIFF_HOURS_ZEROS,
+  DIFF_UNEXPLAINED,
+  DIFF_COUNT,
+} diff_e;
+
+static const char *diff_names[DIFF_COUNT] = {
+    "empty_field", "long_field",  "hours_space",
+    "hours_sign",  "hours_zeros", "unexplained",
+};
+
+typedef struct {
+  uint64_t accepted;
+  uint64_t rejected;
+  uint64_t diffs[DIFF_COUNT];
+} fuzzresult_t;
+
+static uint64_t rng_state;
+static int report_fd = STDERR_FILENO;
+
+static uint64_t rng_next(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void print_usage(char *argv[]) {
+  fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+  fprintf(stderr, "\t-n <inputs>        Random inputs per parser (default "
+                  "1000000)\n");
+  fprintf(stderr, "\t-s <seed>          Generator seed (default 1)\n");
+}
+
+/* The strtok and strtol parser that ADD and UPDATE used before spans. */
+static int ref_parse_hours(const char *hours_str, unsigned int *out) {
+  char *endptr;
+  errno = 0;
+  long value = strtol(hours_str, &endptr, 10);
+
+  if (errno != 0 || endptr == hours_str || *endptr != '\0' || value < 0 ||
+      value > UINT_MAX) {
+    return STATUS_ERROR;
+  }
+  *out = (unsigned int)value;
+  return STATUS_SUCCESS;
+}
+
+static int ref_parse_employee(const char *addstring, employee_t *out) {
+  char *copy = strdup(addstring);
+  if (copy == NULL) {
+    return STATUS_ERROR;
+  }
+
+  char *name = strtok(copy, ",");
+  char *addr = strtok(NULL, ",");
+  char *hours_str = strtok(NULL, ",");
+  unsigned int hours;
+
+  if (name == NULL || addr == NULL || hours_str == NULL ||
+      ref_parse_hours(hours_str, &hours) != STATUS_SUCCESS) {
+    free(copy);
+    return STATUS_ERROR;
+  }
+
+  memset(out, 0, sizeof(*out));
+  strncpy(out->name, name, sizeof(out->name) - 1);
+  strncpy(out->address, addr, sizeof(out->address) - 1);
+  out->hours = hours;
+  free(copy);
+  return STATUS_SUCCESS;
+}
+
+static int ref_parse_update(const char *updatestring, char *name_out,
+                            size_t name_max, unsigned int *hours) {
+  char *copy = strdup(updatestring);
+  if (copy == NULL) {
+    return STATUS_ERROR;
+  }
+
+  char *name = strtok(copy, ",");
+  char *hours_str = strtok(NULL, ",");
+
+  if (name == NULL || hours_str == NULL ||
+      ref_parse_hours(hours_str, hours) != STATUS_SUCCESS) {
+    free(copy);
+    return STATUS_ERROR;
+  }
+  snprintf(name_out, name_max, "%s", name);
+  free(copy);
+  return STATUS_SUCCESS;
+}
+
+static size_t gen_field(char *out, size_t room, const char *alphabet) {
+  size_t len = rng_next() % 24;
+  if (rng_next() % 64 == 0) {
+    len = 250 + rng_next() % 12;
+  }
+  if (len > room) {
+    len = room;
+  }
+
+  size_t n = strlen(alphabet);
+  for (size_t i = 0; i < len; i++) {
+    out[i] = alphabet[rng_next() % n];
+  }
+  return len;
+}
+
+static size_t gen_hours(char *out, size_t room) {
+  static const char *prefixes[] = {"", "", "", "+", " ", "\t", "\n",
+                                   "-", "0000000000", " -"};
+  char buf[64];
+  uint64_t value = rng_next() % 4 == 0 ? rng_next() % 10000000000ull
+                                        : rng_next() % 100;
+  int len = snprintf(buf, sizeof(buf), "%s%lu",
+                     prefixes[rng_next() % 10], value);
+  if (rng_next() % 16 == 0) {
+    buf[len++] = " x,"[rng_next() % 3];
+  }
+  if ((size_t)len > room) {
+    len = room;
+  }
+  memcpy(out, buf, len);
+  return len;
+}
+
+/* Mostly well-formed records, with empty, overlong and malformed fields and
+   stray separators mixed in. Inputs never contain a NUL byte, since the old
+   parser could not see past one. */
+static size_t gen_input(char *out, int fields) {
+  static const char *name_chars = "abcdefghij klmnop";
+  static const char *noise_chars = "ab ,+-09\t\n.";
+  size_t len = 0;
+
+  if (rng_next() % 8 == 0) {
+    len = gen_field(out, INPUT_MAX - 1, noise_chars);
+    out[len] = '\0';
+    return len;
+  }
+
+  for (int i = 0; i < fields; i++) {
+    size_t room = INPUT_MAX - 1 - len;
+    if (i == fields - 1) {
+      len += gen_hours(out + len, room);
+    } else {
+      len += gen_field(out + len, room, name_chars);
+      if (len < INPUT_MAX - 1 && rng_next() % 32 != 0) {
+        out[len++] = ',';
+      }
+    }
+  }
+  if (len < INPUT_MAX - 1 && rng_next() % 16 == 0) {
+    out[len++] = ',';
+  }
+  out[len] = '\0';
+  return len;
+}
+
+static diff_e explain_hours(span_t hours) {
+  size_t i = 0;
+  while (i < hours.len && strchr(" \t\n\v\f\r", hours.ptr[i]) != NULL) {
+    if (hours.ptr[i] != ' ' && hours.ptr[i] != '\t') {
+      return DIFF_HOURS_SPACE;
+    }
+    i++;
+  }
+  if (i < hours.len && hours.ptr[i] == '-') {
+    return DIFF_HOURS_SIGN;
+  }
+  if (i < hours.len && hours.ptr[i] == '+') {
+    i++;
+  }
+  return hours.len - i > 10 ? DIFF_HOURS_ZEROS : DIFF_UNEXPLAINED;
+}
+
+/* Splits the input positionally, as the span parser does, and names the
+   documented behaviour change that accounts for a disagreement. */
+static diff_e explain(const char *input, size_t len, int fields) {
+  span_t rest = {input, len};
+  span_t field[3];
+  int n = 0;
+
+  while (n < fields && span_next_field(&rest, ',', &field[n])) {
+    n++;
+  }
+  for (int i = 0; i < n; i++) {
+    if (field[i].len == 0) {
+      return DIFF_EMPTY_FIELD;
+    }
+  }
+  for (int i = 0; i < n && i < fields - 1; i++) {
+    if (fields == 3 && field[i].len >= sizeof(((employee_t *)0)->name)) {
+      return DIFF_LONG_FIELD;
+    }
+  }
+  return n == fields ? explain_hours(field[fields - 1]) : DIFF_UNEXPLAINED;
+}
+
+static void record_diff(fuzzresult_t *result, const char *kind,
+                        const char *input, diff_e reason) {
+  if (reason == DIFF_UNEXPLAINED &&
+      result->diffs[DIFF_UNEXPLAINED] < EXAMPLES_MAX) {
+    dprintf(report_fd, "%s mismatch: \"%s\"\n", kind, input);
+  }
+  result->diffs[reason]++;
+}
+
+static void fuzz_add(uint64_t inputs, fuzzresult_t *result) {
+  char input[INPUT_MAX];
+  employee_t ref, out;
+
+  for (uint64_t i = 0; i < inputs; i++) {
+    size_t len = gen_input(input, 3);
+    span_t span = {input, len};
+    int want = ref_parse_employee(input, &ref);
+    int got = parse_employee_span(span, &out);
+
+    if (got == STATUS_SUCCESS) {
+      result->accepted++;
+    } else {
+      result->rejected++;
+    }
+    if (want != got ||
+        (got == STATUS_SUCCESS && (strcmp(ref.name, out.name) != 0 ||
+                                   strcmp(ref.address, out.address) != 0 ||
+                                   ref.hours != out.hours))) {
+      record_diff(result, "add", input, explain(input, len, 3));
+    }
+  }
+}
+
+static void fuzz_update(uint64_t inputs, fuzzresult_t *result) {
+  char input[INPUT_MAX];
+  char ref_name[INPUT_MAX];
+  unsigned int ref_hours, hours;
+  span_t name;
+
+  for (uint64_t i = 0; i < inputs; i++) {
+    size_t len = gen_input(input, 2);
+    span_t span = {input, len};
+    int want = ref_parse_update(input, ref_name, sizeof(ref_name), &ref_hours);
+    int got = parse_update_span(span, &name, &hours);
+
+    if (got == STATUS_SUCCESS) {
+      result->accepted++;
+    } else {
+      result->rejected++;
+    }
+    if (want != got ||
+        (got == STATUS_SUCCESS &&
+         (name.len != strlen(ref_name) ||
+          memcmp(name.ptr, ref_name, name.len) != 0 || ref_hours != hours))) {
+      record_diff(result, "update", input, explain(input, len, 2));
+    }
+  }
+}
+
+static void print_result(const char *kind, const fuzzresult_t *result) {
+  printf("  \"%s\": {\"accepted\": %lu, \"rejected\": %lu", kind,
+         result->accepted, result->rejected);
+  for (int d = 0; d < DIFF_COUNT; d++) {
+    printf(", \"%s\": %lu", diff_names[d], result->diffs[d]);
+  }
+  printf("},\n");
+}
+
+/* Times both parsers on well-formed ADD strings only, so neither pays for
+   rejecting input. */
+static int time_parsers(uint64_t parses, double *ref_ns, double *span_ns) {
+  char *records = malloc((size_t)TIMED_RECORDS * 64);
+  size_t *lens = malloc(TIMED_RECORDS * sizeof(size_t));
+  employee_t out;
+  uint64_t failures = 0;
+
+  if (records == NULL || lens == NULL) {
+    free(records);
+    free(lens);
+    return STATUS_ERROR;
+  }
+  for (size_t i = 0; i < TIMED_RECORDS; i++) {
+    lens[i] = snprintf(records + i * 64, 64, "employee%lu,%lu Main St,%lu",
+                       rng_next() % 1000000, rng_next() % 1000,
+                       rng_next() % 80);
+  }
+
+  uint64_t start = now_ns();
+  for (uint64_t i = 0; i < parses; i++) {
+    const char *rec = records + (i % TIMED_RECORDS) * 64;
+    failures += ref_parse_employee(rec, &out) != STATUS_SUCCESS;
+  }
+  *ref_ns = (double)(now_ns() - start) / parses;
+
+  start = now_ns();
+  for (uint64_t i = 0; i < parses; i++) {
+    size_t r = i % TIMED_RECORDS;
+    span_t span = {records + r * 64, lens[r]};
+    failures += parse_employee_span(span, &out) != STATUS_SUCCESS;
+  }
+  *span_ns = (double)(now_ns() - start) / parses;
+
+  free(records);
+  free(lens);
+  return failures == 0 ? STATUS_SUCCESS : STATUS_ERROR;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t inputs = 1000000;
+  uint64_t seed = 1;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:s:")) != -1) {
+    switch (c) {
+    case 'n':
+      inputs = strtoull(optarg, NULL, 10);
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      print_usage(argv);
+      return -1;
+    }
+  }
+
+  if (inputs == 0 || seed == 0) {
+    print_usage(argv);
+    return -1;
+  }
+  rng_state = seed;
+
+  /* Every rejected input logs a warning; keep them out of the report. */
+  int saved_stderr = dup(STDERR_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  if (saved_stderr == -1 || devnull == -1) {
+    perror("open");
+    return -1;
+  }
+
+  fuzzresult_t add = {0}, update = {0};
+  report_fd = saved_stderr;
+  dup2(devnull, STDERR_FILENO);
+  fuzz_add(inputs, &add);
+  fuzz_update(inputs, &update);
+  dup2(saved_stderr, STDERR_FILENO);
+  report_fd = STDERR_FILENO;
+  close(devnull);
+  close(saved_stderr);
+
+  double ref_ns, span_ns;
+  if (time_parsers(inputs, &ref_ns, &span_ns) != STATUS_SUCCESS) {
+    fprintf(stderr, "Timed parse failed\n");
+    return -1;
+  }
+
+  printf("{\n");
+  printf("  \"inputs\": %lu,\n", inputs);
+  printf("  \"seed\": %lu,\n", seed);
+  print_result("add", &add);
+  print_result("update", &update);
+  printf("  \"strtok_ns_per_add\": %.1f,\n", ref_ns);
+  printf("  \"span_ns_per_add\": %.1f\n", span_ns);
+  printf("}\n");
+
+  return add.diffs[DIFF_UNEXPLAINED] == 0 &&
+                 update.diffs[DIFF_UNEXPLAINED] == 0
+             ? 0
+             : 1;
+}
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "parse.h"
+
+#define NSEC_PER_SEC 1000000000ull
+
+typedef enum {
+  GROW_GEOMETRIC,
+  GROW_EXACT,
+} growmode_e;
+
+typedef struct {
+  uint64_t elapsed;
+  uint64_t reallocs;
+  uint64_t moves;
+  size_t capacity;
+} storeresult_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void print_usage(char *argv[]) {
+  fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+  fprintf(stderr, "\t-n <records>       Inserts per run (default 1000000)\n");
+  fprintf(stderr, "\t-r <runs>          Runs per growth mode, the fastest "
+                  "is kept (default 3)\n");
+}
+
+static void free_store(database_t *db) {
+  free(db->records);
+  strarena_free(&db->strings);
+  nameindex_free(&db->index);
+  hoursindex_free(&db->hours);
+}
+
+/* Inserts through the same path as ADD, with no file or log attached. In
+   exact mode the array is resized to the new count before every insert,
+   the way add_employee grew it before it had a capacity of its own. */
+static int run_store(growmode_e mode, uint64_t records,
+                     storeresult_t *result) {
+  database_t db = {0};
+  dbheader_t hdr = {0};
+  employee_t employee = {0};
+  int ret = STATUS_ERROR;
+
+  db.hdr = &hdr;
+  if (strarena_reset(&db.strings) != STATUS_SUCCESS ||
+      nameindex_build(&db.index, &db, 0) != STATUS_SUCCESS) {
+    goto out;
+  }
+
+  *result = (storeresult_t){0};
+  uint64_t start = now_ns();
+  for (uint64_t i = 0; i < records; i++) {
+    dbrecord_t *old_records = db.records;
+    size_t old_capacity = db.capacity;
+
+    snprintf(employee.name, sizeof(employee.name), "e%lu", i);
+    snprintf(employee.address, sizeof(employee.address), "%lu Main St",
+             i % 1000);
+    employee.hours = i % 80;
+
+    if (mode == GROW_EXACT &&
+        reserve_employees(&db, hdr.count + 1) != STATUS_SUCCESS) {
+      goto out;
+    }
+    if (insert_employee(&db, &employee) != STATUS_SUCCESS) {
+      goto out;
+    }
+
+    if (db.capacity != old_capacity) {
+      result->reallocs++;
+    }
+    if (db.records != old_records) {
+      result->moves++;
+    }
+  }
+  result->elapsed = now_ns() - start;
+  result->capacity = db.capacity;
+  ret = STATUS_SUCCESS;
+
+out:
+  free_store(&db);
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  static const char *modes[] = {"geometric", "exact"};
+  uint64_t records = 1000000;
+  int runs = 3;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:r:")) != -1) {
+    switch (c) {
+    case 'n':
+      records = strtoull(optarg, NULL, 10);
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    default:
+      print_usage(argv);
+      return -1;
+    }
+  }
+
+  if (records == 0 || records >= NAMEINDEX_EMPTY || runs <= 0) {
+    print_usage(argv);
+    return -1;
+  }
+
+  printf("{\n");
+  printf("  \"records\": %lu,\n", records);
+  printf("  \"runs\": %d,\n", runs);
+  for (int m = GROW_GEOMETRIC; m <= GROW_EXACT; m++) {
+    storeresult_t best = {0};
+
+    for (int r = 0; r < runs; r++) {
+      storeresult_t result;
+      if (run_store(m, records, &result) != STATUS_SUCCESS) {
+        fprintf(stderr, "%s run failed\n", modes[m]);
+        return -1;
+      }
+      if (r == 0 || result.elapsed < best.elapsed) {
+        best = result;
+      }
+    }
+
+    printf("  \"%s\": {\"ns_per_insert\": %.1f, \"reallocs\": %lu, "
+           "\"moves\": %lu, \"capacity\": %zu}%s\n",
+           modes[m], (double)best.elapsed / records, best.reallocs,
+           best.moves, best.capacity, m == GROW_EXACT ? "" : ",");
+  }
+  printf("}\n");
+  return 0;
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "common.h"
+#include "log.h"
+
+#define STRARENA_MIN_SLOTS 16
+#define STRARENA_MIN_CAP 4096
+
+static uint32_t hash_string(const char *str, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)str[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int alloc_slots(strarena_t *arena, size_t nslots) {
+  strarena_slot_t *slots = malloc(nslots * sizeof(strarena_slot_t));
+  if (slots == NULL) {
+    log_error("Failed to allocate string intern table: %m");
+    return STATUS_ERROR;
+  }
+  for (size_t i = 0; i < nslots; i++) {
+    slots[i].off = 0;
+  }
+  arena->slots = slots;
+  arena->mask = nslots - 1;
+  return STATUS_SUCCESS;
+}
+
+static void place(strarena_t *arena, uint32_t hash, uint32_t off) {
+  size_t i = hash & arena->mask;
+  while (arena->slots[i].off != 0) {
+    i = (i + 1) & arena->mask;
+  }
+  arena->slots[i].hash = hash;
+  arena->slots[i].off = off;
+  arena->count++;
+}
+
+static int grow_slots(strarena_t *arena) {
+  strarena_slot_t *old = arena->slots;
+  size_t old_nslots = arena->mask + 1;
+
+  if (alloc_slots(arena, old_nslots * 2) != STATUS_SUCCESS) {
+    arena->slots = old;
+    return STATUS_ERROR;
+  }
+
+  arena->count = 0;
+  for (size_t i = 0; i < old_nslots; i++) {
+    if (old[i].off != 0) {
+      place(arena, old[i].hash, old[i].off);
+    }
+  }
+  free(old);
+  return STATUS_SUCCESS;
+}
+
+/* Offset 0 always holds the empty string, so 0 doubles as the empty slot. */
+int strarena_reset(strarena_t *arena) {
+  char *data = malloc(STRARENA_MIN_CAP);
+  if (data == NULL) {
+    log_error("Failed to allocate string arena: %m");
+    return STATUS_ERROR;
+  }
+  data[0] = '\0';
+
+  strarena_free(arena);
+  if (alloc_slots(arena, STRARENA_MIN_SLOTS) != STATUS_SUCCESS) {
+    free(data);
+    return STATUS_ERROR;
+  }
+  arena->data = data;
+  arena->len = 1;
+  arena->cap = STRARENA_MIN_CAP;
+  arena->dead = 0;
+  arena->count = 0;
+  return STATUS_SUCCESS;
+}
+
+int strarena_adopt(strarena_t *arena, char *data, size_t len) {
+  if (len == 0 || len > STRARENA_MAX || data[0] != '\0' ||
+      data[len - 1] != '\0') {
+    log_error("Corrupted database. Invalid string arena.");
+    free(data);
+    return STATUS_ERROR;
+  }
+
+  size_t nslots = STRARENA_MIN_SLOTS;
+  size_t strings = 0;
+  for (size_t off = 1; off < len; off += strlen(data + off) + 1) {
+    strings++;
+  }
+  while (nslots * 7 < strings * 10) {
+    nslots *= 2;
+  }
+
+  strarena_free(arena);
+  if (alloc_slots(arena, nslots) != STATUS_SUCCESS) {
+    free(data);
+    return STATUS_ERROR;
+  }
+  arena->data = data;
+  arena->len = len;
+  arena->cap = len;
+  arena->dead = 0;
+  arena->count = 0;
+
+  for (size_t off = 1; off < len;) {
+    size_t n = strlen(data + off);
+    if (n > 0) {
+      place(arena, hash_string(data + off, n), off);
+    }
+    off += n + 1;
+  }
+  return STATUS_SUCCESS;
+}
+
+void strarena_free(strarena_t *arena) {
+  free(arena->data);
+  free(arena->slots);
+  arena->data = NULL;
+  arena->slots = NULL;
+  arena->len = 0;
+  arena->cap = 0;
+  arena->dead = 0;
+  arena->mask = 0;
+  arena->count = 0;
+}
+
+/* Makes room for a number of new strings taking bytes in total,
+   terminators included, so interning them next cannot fail. */
+int strarena_reserve(strarena_t *arena, size_t bytes, size_t strings) {
+  if (arena->len + bytes > STRARENA_MAX) {
+    log_error("String arena is full.");
+    return STATUS_ERROR;
+  }
+
+  if (arena->len + bytes > arena->cap) {
+    size_t cap = arena->cap ? arena->cap : STRARENA_MIN_CAP;
+    while (cap < arena->len + bytes) {
+      cap *= 2;
+    }
+    char *data = realloc(arena->data, cap);
+    if (data == NULL) {
+      log_error("Failed to grow string arena: %m");
+      return STATUS_ERROR;
+    }
+    arena->data = data;
+    arena->cap = cap;
+  }
+
+  while ((arena->count + strings) * 10 > (arena->mask + 1) * 7) {
+    if (grow_slots(arena) != STATUS_SUCCESS) {
+      return STATUS_ERROR;
+    }
+  }
+  return STATUS_SUCCESS;
+}
+
+int strarena_intern(strarena_t *arena, const char *str, size_t len,
+                    uint32_t *off) {
+  if (len == 0) {
+    *off = 0;
+    return STATUS_SUCCESS;
+  }
+
+  uint32_t hash = hash_string(str, len);
+  size_t i = hash & arena->mask;
+  while (arena->slots[i].off != 0) {
+    size_t cand_off = arena->slots[i].off;
+    const char *candidate = arena->data + cand_off;
+    if (arena->slots[i].hash == hash && cand_off + len < arena->len &&
+        memcmp(candidate, str, len) == 0 && candidate[len] == '\0') {
+      *off = cand_off;
+      return STATUS_SUCCESS;
+    }
+    i = (i + 1) & arena->mask;
+  }
+
+  if (strarena_reserve(arena, len + 1, 1) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  *off = arena->len;
+  memcpy(arena->data + arena->len, str, len);
+  arena->data[arena->len + len] = '\0';
+  arena->len += len + 1;
+  place(arena, hash, *off);
+  return STATUS_SUCCESS;
+}
+
+bool strarena_valid(const strarena_t *arena, uint32_t off, size_t len) {
+  return (size_t)off + len < arena->len && arena->data[off + len] == '\0' &&
+         memchr(arena->data + off, '\0', len) == NULL;
+}
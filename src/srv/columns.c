@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "columns.h"
+#include "common.h"
+#include "log.h"
+
+int columns_reserve(dbcolumns_t *cols, size_t capacity) {
+  if (capacity <= cols->capacity) {
+    return STATUS_SUCCESS;
+  }
+
+  uint32_t *hours = realloc(cols->hours, capacity * sizeof(uint32_t));
+  if (hours == NULL) {
+    log_error("Failed to grow hours column: %m");
+    return STATUS_ERROR;
+  }
+  cols->hours = hours;
+  cols->capacity = capacity;
+  return STATUS_SUCCESS;
+}
+
+void columns_free(dbcolumns_t *cols) {
+  free(cols->hours);
+  cols->hours = NULL;
+  cols->capacity = 0;
+}
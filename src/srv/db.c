@@ -0,0 +1,305 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "db.h"
+#include "file.h"
+#include "log.h"
+#include "metrics.h"
+#include "parse.h"
+#include "save.h"
+#include "wal.h"
+
+static int open_wal_for(database_t *db, const char *filepath, bool newfile,
+                        const dbconfig_t *config) {
+  size_t path_len = strlen(filepath) + sizeof(".wal");
+  char *wal_path = malloc(path_len);
+  if (wal_path == NULL) {
+    log_error("Failed to allocate WAL path: %m");
+    return STATUS_ERROR;
+  }
+  snprintf(wal_path, path_len, "%s.wal", filepath);
+
+  int ret = wal_open(wal_path, config->sync, config->checkpoint_bytes, newfile,
+                     header_epoch(db->hdr), &db->wal);
+  free(wal_path);
+  return ret;
+}
+
+/* Replays the segment an interrupted background save moved aside, then the
+   live log. Each segment applies on top of the epoch it was started from,
+   so one that a finished snapshot already covers is skipped. */
+static int replay_wal(database_t *db, bool newfile) {
+  unsigned epoch = header_epoch(db->hdr);
+  int replayed = 0;
+
+  if (access(db->wal->rotated_path, F_OK) == 0) {
+    wal_t *old;
+    if (wal_open(db->wal->rotated_path, WAL_SYNC_NONE, 0, false, epoch,
+                 &old) != STATUS_SUCCESS) {
+      return STATUS_ERROR;
+    }
+    db->wal->rotated = true;
+    if (!newfile && old->epoch == epoch) {
+      replayed = wal_replay(old, db);
+      epoch = (epoch + 1) % EPOCH_COUNT;
+    } else {
+      log_info("Discarding write-ahead log segment already in the database "
+               "file");
+    }
+    wal_close(old);
+    if (replayed == STATUS_ERROR) {
+      return STATUS_ERROR;
+    }
+  }
+
+  if (db->wal->epoch != epoch) {
+    log_info("Skipping write-ahead log already in the database file");
+    return replayed;
+  }
+  int n = wal_replay(db->wal, db);
+  return n == STATUS_ERROR ? STATUS_ERROR : replayed + n;
+}
+
+int db_open(database_t *db, char *filepath, bool newfile,
+            const dbconfig_t *config) {
+  db->hdr = NULL;
+  db->records = NULL;
+  db->capacity = 0;
+  db->strings_synced = 0;
+  db->records_synced = 0;
+  db->columns = NULL;
+  db->hours = (hoursindex_t){0};
+  db->mapped = config->mmap;
+  db->map = NULL;
+  db->map_len = 0;
+  db->wal = NULL;
+  db->saver = NULL;
+  db->fd = -1;
+  db->path = strdup(filepath);
+  if (db->path == NULL) {
+    log_error("Failed to allocate database path: %m");
+    return STATUS_ERROR;
+  }
+
+  if (strarena_reset(&db->strings) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  if (newfile) {
+    db->fd = create_db_file(filepath);
+    if (db->fd == STATUS_ERROR) {
+      return STATUS_ERROR;
+    }
+
+    if (create_db_header(db->fd, &db->hdr) == STATUS_ERROR) {
+      return STATUS_ERROR;
+    }
+
+    if (output_file(db) != STATUS_SUCCESS ||
+        fsync(db->fd) == -1) {
+      log_error("Failed to initialize new database file");
+      return STATUS_ERROR;
+    }
+  } else {
+    db->fd = open_db_file(filepath);
+    if (db->fd == STATUS_ERROR) {
+      return STATUS_ERROR;
+    }
+
+    if (validate_db_header(db->fd, &db->hdr) == STATUS_ERROR) {
+      return STATUS_ERROR;
+    }
+
+    if (upgrade_db_file(db) != STATUS_SUCCESS) {
+      return STATUS_ERROR;
+    }
+  }
+
+  if (read_employees(db) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  if (open_wal_for(db, filepath, newfile, config) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  int replayed = replay_wal(db, newfile);
+  if (replayed == STATUS_ERROR) {
+    goto close_wal;
+  }
+
+  if (replayed > 0) {
+    log_info("Replayed %d record(s) from the write-ahead log", replayed);
+  }
+
+  if (replayed > 0 || db->wal->version != WAL_VERSION || db->wal->rotated ||
+      db->wal->epoch != header_epoch(db->hdr)) {
+    if (db_checkpoint(db) != STATUS_SUCCESS) {
+      goto close_wal;
+    }
+  }
+
+  if (hoursindex_build(&db->hours, db, db->hdr->count) != STATUS_SUCCESS) {
+    goto close_wal;
+  }
+
+  if (config->columnar && build_columns(db) != STATUS_SUCCESS) {
+    goto close_wal;
+  }
+
+  if (config->uring && wal_enable_uring(db->wal) == STATUS_SUCCESS) {
+    log_info("Committing the write-ahead log through io_uring");
+  }
+
+  if (saver_start(db, &config->save, &db->saver) != STATUS_SUCCESS) {
+    goto close_wal;
+  }
+
+  return STATUS_SUCCESS;
+
+close_wal:
+  wal_close(db->wal);
+  db->wal = NULL;
+  return STATUS_ERROR;
+}
+
+int db_commit(database_t *db) {
+  if (wal_commit(db->wal) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  if (wal_needs_checkpoint(db->wal)) {
+    db_save(db);
+  }
+
+  return STATUS_SUCCESS;
+}
+
+/* The caller holds back responses until db_committed() reaches the
+   returned batch. With io_uring the commit completes later and db_reap()
+   picks it up; without it the batch is committed on return unless the log
+   has failed. */
+uint64_t db_submit(database_t *db) {
+  uint64_t target = wal_submit(db->wal);
+  if (db->wal->ring == NULL && wal_needs_checkpoint(db->wal)) {
+    db_save(db);
+  }
+  return target;
+}
+
+uint64_t db_committed(database_t *db) { return wal_committed(db->wal); }
+
+/* Once set, batches past db_committed() will never commit. */
+bool db_failed(database_t *db) { return wal_failed(db->wal); }
+
+void db_reap(database_t *db) {
+  wal_reap(db->wal);
+  if (wal_needs_checkpoint(db->wal)) {
+    db_save(db);
+  }
+}
+
+/* Becomes readable when io_uring completions need reaping, or -1 if
+   commits are synchronous. One reactor reaping them is enough. */
+int db_commit_fd(database_t *db) { return db->wal->event_fd; }
+
+int db_add_waiter(database_t *db, wal_waiter_t *waiter) {
+  return wal_add_waiter(db->wal, waiter);
+}
+
+void db_remove_waiter(database_t *db, wal_waiter_t *waiter) {
+  wal_remove_waiter(db->wal, waiter);
+}
+
+bool db_watch(database_t *db, wal_waiter_t *waiter, uint64_t batch) {
+  return wal_watch(db->wal, waiter, batch);
+}
+
+/* Queues a background save. Returns false if one was already queued or
+   running. */
+bool db_save(database_t *db) {
+  if (db->saver == NULL) {
+    db_checkpoint(db);
+    return true;
+  }
+  return saver_request(db->saver);
+}
+
+int db_checkpoint(database_t *db) {
+  int ret = STATUS_SUCCESS;
+
+  pthread_rwlock_wrlock(&db->lock);
+  uint64_t start = metrics_now();
+
+  unsigned epoch = (db->wal->epoch + 1) % EPOCH_COUNT;
+  set_header_epoch(db->hdr, epoch);
+  if (db->map != NULL) {
+    ret = sync_mapped_file(db);
+  } else {
+    ret = output_file(db);
+  }
+
+  if (ret != STATUS_SUCCESS || fsync(db->fd) == -1) {
+    log_error("Checkpoint failed, keeping write-ahead log");
+    ret = STATUS_ERROR;
+  } else {
+    ret = wal_reset(db->wal, epoch);
+    if (ret == STATUS_SUCCESS) {
+      ret = wal_drop_rotated(db->wal);
+    }
+  }
+
+  metrics_phase(METRIC_CHECKPOINT, metrics_now() - start);
+  pthread_rwlock_unlock(&db->lock);
+  return ret;
+}
+
+void db_close(database_t *db) {
+  if (db->saver != NULL) {
+    saver_stop(db->saver);
+    db->saver = NULL;
+  }
+
+  if (db->wal != NULL) {
+    db_checkpoint(db);
+    wal_close(db->wal);
+    db->wal = NULL;
+  }
+
+  if (db->map != NULL) {
+    unmap_employees(db);
+  }
+
+  if (db->hdr != NULL) {
+    free(db->hdr);
+    db->hdr = NULL;
+  }
+  if (db->records != NULL) {
+    free(db->records);
+    db->records = NULL;
+    db->capacity = 0;
+  }
+  strarena_free(&db->strings);
+  if (db->columns != NULL) {
+    columns_free(db->columns);
+    free(db->columns);
+    db->columns = NULL;
+  }
+  nameindex_free(&db->index);
+  hoursindex_free(&db->hours);
+
+  if (db->fd >= 0) {
+    if (close(db->fd) == -1) {
+      log_error("Error closing file descriptor: %m");
+    }
+    db->fd = -1;
+  }
+  free(db->path);
+  db->path = NULL;
+
+  pthread_rwlock_destroy(&db->lock);
+}
@@ -1,16 +1,21 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <libgen.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "common.h"
 #include "file.h"
+#include "log.h"
 
 int create_db_file(char *filename) {
   int fd = open(filename, O_RDWR | O_CREAT | O_EXCL, 0644);
   if (fd == STATUS_ERROR) {
-    perror("create_db_file failed");
+    log_error("create_db_file failed: %m");
     return STATUS_ERROR;
   }
 
@@ -20,9 +25,69 @@ int create_db_file(char *filename) {
 int open_db_file(char *filename) {
   int fd = open(filename, O_RDWR);
   if (fd == STATUS_ERROR) {
-    perror("open_db_file failed");
+    log_error("open_db_file failed: %m");
     return STATUS_ERROR;
   }
 
   return fd;
 }
+
+/* Opens <filename>.tmp, truncated, for a snapshot that will replace
+   filename. */
+int create_temp_file(const char *filename, char **tmp_path_out) {
+  size_t path_len = strlen(filename) + sizeof(".tmp");
+  char *tmp_path = malloc(path_len);
+  if (tmp_path == NULL) {
+    log_error("Failed to allocate temporary path: %m");
+    return STATUS_ERROR;
+  }
+  snprintf(tmp_path, path_len, "%s.tmp", filename);
+
+  int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == STATUS_ERROR) {
+    log_error("create_temp_file failed: %m");
+    free(tmp_path);
+    return STATUS_ERROR;
+  }
+
+  *tmp_path_out = tmp_path;
+  return fd;
+}
+
+static int sync_parent_dir(const char *path) {
+  char *copy = strdup(path);
+  if (copy == NULL) {
+    log_error("Failed to allocate directory path: %m");
+    return STATUS_ERROR;
+  }
+
+  int ret = STATUS_SUCCESS;
+  int dir_fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1 || fsync(dir_fd) == -1) {
+    log_error("Failed to sync database directory: %m");
+    ret = STATUS_ERROR;
+  }
+  if (dir_fd != -1) {
+    close(dir_fd);
+  }
+  free(copy);
+  return ret;
+}
+
+/* Renames from over to and syncs the directory so the rename survives a
+   crash. */
+int replace_file(const char *from, const char *to) {
+  if (rename(from, to) == -1) {
+    log_error("rename failed: %m");
+    return STATUS_ERROR;
+  }
+  return sync_parent_dir(to);
+}
+
+int remove_file(const char *path) {
+  if (unlink(path) == -1 && errno != ENOENT) {
+    log_error("unlink failed: %m");
+    return STATUS_ERROR;
+  }
+  return sync_parent_dir(path);
+}
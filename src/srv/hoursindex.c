@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "hoursindex.h"
+#include "log.h"
+#include "parse.h"
+
+#define HOURSINDEX_MIN_LEAVES 16
+#define HOURSINDEX_FILL (HOURSINDEX_LEAF * 3 / 4)
+#define HOURSINDEX_SPARSE (HOURSINDEX_LEAF / 4)
+
+static int compare_keys(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int reserve_leaves(hoursindex_t *index, size_t nleaves) {
+  if (nleaves <= index->capacity) {
+    return STATUS_SUCCESS;
+  }
+
+  size_t capacity = index->capacity ? index->capacity : HOURSINDEX_MIN_LEAVES;
+  while (capacity < nleaves) {
+    capacity *= 2;
+  }
+
+  hoursindex_leaf_t **leaves =
+      realloc(index->leaves, capacity * sizeof(hoursindex_leaf_t *));
+  if (leaves == NULL) {
+    log_error("Failed to grow hours index: %m");
+    return STATUS_ERROR;
+  }
+  index->leaves = leaves;
+  index->capacity = capacity;
+  return STATUS_SUCCESS;
+}
+
+/* Last leaf whose first key is <= key, or the first leaf. */
+static size_t find_leaf(const hoursindex_t *index, uint64_t key) {
+  size_t lo = 0;
+  size_t hi = index->nleaves;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (index->leaves[mid]->keys[0] <= key) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* First slot holding a key >= key. */
+static size_t lower_bound(const hoursindex_leaf_t *leaf, uint64_t key) {
+  size_t lo = 0;
+  size_t hi = leaf->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (leaf->keys[mid] < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* First slot holding a key > key. */
+static size_t upper_bound(const hoursindex_leaf_t *leaf, uint64_t key) {
+  size_t lo = 0;
+  size_t hi = leaf->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (leaf->keys[mid] <= key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int hoursindex_build(hoursindex_t *index, const database_t *db,
+                     size_t count) {
+  uint64_t *keys = malloc((count ? count : 1) * sizeof(uint64_t));
+  if (keys == NULL) {
+    log_error("Failed to allocate hours index: %m");
+    return STATUS_ERROR;
+  }
+
+  for (size_t row = 0; row < count; row++) {
+    keys[row] = hoursindex_key(db->records[row].hours, row);
+  }
+  qsort(keys, count, sizeof(uint64_t), compare_keys);
+
+  hoursindex_free(index);
+
+  /* Leaves start partly empty so inserts rarely split them. */
+  size_t nleaves = (count + HOURSINDEX_FILL - 1) / HOURSINDEX_FILL;
+  if (reserve_leaves(index, nleaves) != STATUS_SUCCESS) {
+    free(keys);
+    return STATUS_ERROR;
+  }
+
+  for (size_t i = 0; i < nleaves; i++) {
+    hoursindex_leaf_t *leaf = malloc(sizeof(hoursindex_leaf_t));
+    if (leaf == NULL) {
+      log_error("Failed to allocate hours index: %m");
+      free(keys);
+      hoursindex_free(index);
+      return STATUS_ERROR;
+    }
+    size_t start = i * HOURSINDEX_FILL;
+    leaf->count =
+        count - start < HOURSINDEX_FILL ? count - start : HOURSINDEX_FILL;
+    memcpy(leaf->keys, keys + start, leaf->count * sizeof(uint64_t));
+    index->leaves[i] = leaf;
+    index->nleaves = i + 1;
+  }
+
+  index->count = count;
+  free(keys);
+  return STATUS_SUCCESS;
+}
+
+void hoursindex_free(hoursindex_t *index) {
+  for (size_t i = 0; i < index->nleaves; i++) {
+    free(index->leaves[i]);
+  }
+  free(index->leaves);
+  free(index->spare);
+  index->leaves = NULL;
+  index->nleaves = 0;
+  index->capacity = 0;
+  index->count = 0;
+  index->spare = NULL;
+}
+
+/* An insert splits at most one leaf, so holding one spare leaf and one free
+   pointer slot lets callers reserve before they log a change and then apply
+   it without a failure path. */
+int hoursindex_reserve(hoursindex_t *index) {
+  if (reserve_leaves(index, index->nleaves + 1) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+  if (index->spare == NULL) {
+    index->spare = malloc(sizeof(hoursindex_leaf_t));
+    if (index->spare == NULL) {
+      log_error("Failed to grow hours index: %m");
+      return STATUS_ERROR;
+    }
+  }
+  return STATUS_SUCCESS;
+}
+
+static hoursindex_leaf_t *take_spare(hoursindex_t *index) {
+  hoursindex_leaf_t *leaf = index->spare;
+  index->spare = NULL;
+  leaf->count = 0;
+  return leaf;
+}
+
+void hoursindex_insert(hoursindex_t *index, uint32_t hours, uint32_t row) {
+  uint64_t key = hoursindex_key(hours, row);
+
+  if (index->nleaves == 0) {
+    index->leaves[0] = take_spare(index);
+    index->nleaves = 1;
+  }
+
+  size_t l = find_leaf(index, key);
+  hoursindex_leaf_t *leaf = index->leaves[l];
+  size_t pos = lower_bound(leaf, key);
+
+  if (leaf->count == HOURSINDEX_LEAF) {
+    const size_t half = HOURSINDEX_LEAF / 2;
+    hoursindex_leaf_t *right = take_spare(index);
+    right->count = HOURSINDEX_LEAF - half;
+    memcpy(right->keys, leaf->keys + half, right->count * sizeof(uint64_t));
+    leaf->count = half;
+
+    memmove(&index->leaves[l + 2], &index->leaves[l + 1],
+            (index->nleaves - l - 1) * sizeof(hoursindex_leaf_t *));
+    index->leaves[l + 1] = right;
+    index->nleaves++;
+
+    if (pos > half) {
+      leaf = right;
+      pos -= half;
+    }
+  }
+
+  memmove(&leaf->keys[pos + 1], &leaf->keys[pos],
+          (leaf->count - pos) * sizeof(uint64_t));
+  leaf->keys[pos] = key;
+  leaf->count++;
+  index->count++;
+}
+
+static void drop_leaf(hoursindex_t *index, size_t l) {
+  hoursindex_leaf_t *leaf = index->leaves[l];
+  memmove(&index->leaves[l], &index->leaves[l + 1],
+          (index->nleaves - l - 1) * sizeof(hoursindex_leaf_t *));
+  index->nleaves--;
+
+  if (index->spare == NULL) {
+    index->spare = leaf;
+  } else {
+    free(leaf);
+  }
+}
+
+static void merge_leaves(hoursindex_t *index, size_t l) {
+  hoursindex_leaf_t *left = index->leaves[l];
+  hoursindex_leaf_t *right = index->leaves[l + 1];
+  memcpy(left->keys + left->count, right->keys,
+         right->count * sizeof(uint64_t));
+  left->count += right->count;
+  drop_leaf(index, l + 1);
+}
+
+void hoursindex_remove(hoursindex_t *index, uint32_t hours, uint32_t row) {
+  if (index->nleaves == 0) {
+    return;
+  }
+
+  uint64_t key = hoursindex_key(hours, row);
+  size_t l = find_leaf(index, key);
+  hoursindex_leaf_t *leaf = index->leaves[l];
+  size_t pos = lower_bound(leaf, key);
+  if (pos == leaf->count || leaf->keys[pos] != key) {
+    return;
+  }
+
+  memmove(&leaf->keys[pos], &leaf->keys[pos + 1],
+          (leaf->count - pos - 1) * sizeof(uint64_t));
+  leaf->count--;
+  index->count--;
+
+  if (leaf->count >= HOURSINDEX_SPARSE) {
+    return;
+  }
+
+  if (l + 1 < index->nleaves &&
+      leaf->count + index->leaves[l + 1]->count <= HOURSINDEX_LEAF) {
+    merge_leaves(index, l);
+  } else if (l > 0 &&
+             index->leaves[l - 1]->count + leaf->count <= HOURSINDEX_LEAF) {
+    merge_leaves(index, l - 1);
+  } else if (leaf->count == 0) {
+    drop_leaf(index, l);
+  }
+}
+
+/* Copies up to max keys in [from, to], walking up from `from` or down from
+   `to`. Callers resume by passing the key after the last one returned. */
+size_t hoursindex_scan(const hoursindex_t *index, uint64_t from, uint64_t to,
+                       bool descending, uint64_t *keys, size_t max) {
+  size_t n = 0;
+
+  if (index->nleaves == 0 || from > to) {
+    return 0;
+  }
+
+  if (!descending) {
+    size_t l = find_leaf(index, from);
+    size_t pos = lower_bound(index->leaves[l], from);
+    while (n < max && l < index->nleaves) {
+      const hoursindex_leaf_t *leaf = index->leaves[l];
+      if (pos == leaf->count) {
+        l++;
+        pos = 0;
+        continue;
+      }
+      if (leaf->keys[pos] > to) {
+        break;
+      }
+      keys[n++] = leaf->keys[pos++];
+    }
+    return n;
+  }
+
+  size_t l = find_leaf(index, to);
+  size_t pos = upper_bound(index->leaves[l], to);
+  while (n < max) {
+    if (pos == 0) {
+      if (l == 0) {
+        break;
+      }
+      l--;
+      pos = index->leaves[l]->count;
+      continue;
+    }
+    uint64_t key = index->leaves[l]->keys[pos - 1];
+    if (key < from) {
+      break;
+    }
+    keys[n++] = key;
+    pos--;
+  }
+  return n;
+}
@@ -0,0 +1,169 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "index.h"
+#include "log.h"
+#include "parse.h"
+
+#define NAMEINDEX_MIN_SLOTS 16
+
+static uint32_t hash_name(const char *name) {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static int alloc_slots(nameindex_t *index, size_t nslots) {
+  nameindex_slot_t *slots = malloc(nslots * sizeof(nameindex_slot_t));
+  if (slots == NULL) {
+    log_error("Failed to allocate name index: %m");
+    return STATUS_ERROR;
+  }
+  for (size_t i = 0; i < nslots; i++) {
+    slots[i].row = NAMEINDEX_EMPTY;
+  }
+  index->slots = slots;
+  index->mask = nslots - 1;
+  return STATUS_SUCCESS;
+}
+
+static void place(nameindex_t *index, uint32_t hash, uint32_t row) {
+  size_t i = hash & index->mask;
+  while (index->slots[i].row != NAMEINDEX_EMPTY) {
+    i = (i + 1) & index->mask;
+  }
+  index->slots[i].hash = hash;
+  index->slots[i].row = row;
+}
+
+static int grow(nameindex_t *index) {
+  nameindex_slot_t *old = index->slots;
+  size_t old_nslots = index->mask + 1;
+
+  if (alloc_slots(index, old_nslots * 2) != STATUS_SUCCESS) {
+    index->slots = old;
+    return STATUS_ERROR;
+  }
+
+  for (size_t i = 0; i < old_nslots; i++) {
+    if (old[i].row != NAMEINDEX_EMPTY) {
+      place(index, old[i].hash, old[i].row);
+    }
+  }
+  free(old);
+  return STATUS_SUCCESS;
+}
+
+static const char *row_name(const database_t *db, uint32_t row) {
+  return record_name(db, &db->records[row]);
+}
+
+int nameindex_build(nameindex_t *index, const database_t *db, size_t count) {
+  size_t nslots = NAMEINDEX_MIN_SLOTS;
+  while (nslots * 7 < count * 10) {
+    nslots *= 2;
+  }
+
+  if (alloc_slots(index, nslots) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+  index->count = 0;
+
+  for (size_t row = 0; row < count; row++) {
+    place(index, hash_name(row_name(db, row)), row);
+    index->count++;
+  }
+  return STATUS_SUCCESS;
+}
+
+void nameindex_free(nameindex_t *index) {
+  free(index->slots);
+  index->slots = NULL;
+  index->mask = 0;
+  index->count = 0;
+}
+
+int nameindex_insert(nameindex_t *index, const database_t *db, uint32_t row) {
+  if ((index->count + 1) * 10 > (index->mask + 1) * 7 &&
+      grow(index) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  place(index, hash_name(row_name(db, row)), row);
+  index->count++;
+  return STATUS_SUCCESS;
+}
+
+static long find_slot(const nameindex_t *index, const database_t *db,
+                      const char *name, uint32_t hash) {
+  size_t i = hash & index->mask;
+  while (index->slots[i].row != NAMEINDEX_EMPTY) {
+    if (index->slots[i].hash == hash &&
+        strcmp(row_name(db, index->slots[i].row), name) == 0) {
+      return i;
+    }
+    i = (i + 1) & index->mask;
+  }
+  return STATUS_ERROR;
+}
+
+static long find_row_slot(const nameindex_t *index, uint32_t hash,
+                          uint32_t row) {
+  size_t i = hash & index->mask;
+  while (index->slots[i].row != NAMEINDEX_EMPTY) {
+    if (index->slots[i].row == row) {
+      return i;
+    }
+    i = (i + 1) & index->mask;
+  }
+  return STATUS_ERROR;
+}
+
+long nameindex_find(const nameindex_t *index, const database_t *db,
+                    const char *name) {
+  if (index->slots == NULL || !name) {
+    return STATUS_ERROR;
+  }
+
+  long slot = find_slot(index, db, name, hash_name(name));
+  if (slot == STATUS_ERROR) {
+    return STATUS_ERROR;
+  }
+  return index->slots[slot].row;
+}
+
+void nameindex_remove(nameindex_t *index, const database_t *db, uint32_t row) {
+  long slot = find_row_slot(index, hash_name(row_name(db, row)), row);
+  if (slot == STATUS_ERROR) {
+    return;
+  }
+
+  /* Backward-shift deletion keeps probe chains intact without tombstones. */
+  size_t hole = slot;
+  size_t i = (hole + 1) & index->mask;
+  while (index->slots[i].row != NAMEINDEX_EMPTY) {
+    size_t home = index->slots[i].hash & index->mask;
+    if (((i - home) & index->mask) >= ((i - hole) & index->mask)) {
+      index->slots[hole] = index->slots[i];
+      hole = i;
+    }
+    i = (i + 1) & index->mask;
+  }
+  index->slots[hole].row = NAMEINDEX_EMPTY;
+  index->count--;
+}
+
+void nameindex_renumber(nameindex_t *index, const char *name, uint32_t from,
+                        uint32_t to) {
+  long slot = find_row_slot(index, hash_name(name), from);
+  if (slot != STATUS_ERROR) {
+    index->slots[slot].row = to;
+  }
+}
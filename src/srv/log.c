@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "log.h"
+
+#define LOG_OUT_MAX (64 * 1024)
+#define LOG_FLUSH_INTERVAL_NS 10000000
+
+typedef struct {
+  uint64_t seq;
+  uint64_t time;
+  const char *file;
+  uint32_t line;
+  uint16_t level;
+  uint16_t len;
+  uint32_t thread;
+  char text[LOG_LINE_MAX];
+} __attribute__((aligned(64))) log_entry_t;
+
+typedef struct {
+  int fd;
+  size_t len;
+  char data[LOG_OUT_MAX];
+} log_out_t;
+
+/* Bounded MPSC ring: producers claim a slot by advancing tail, format into
+   it and publish it by bumping its sequence number. The flusher is the only
+   consumer, so head needs no atomics. */
+static struct {
+  log_entry_t *entries;
+  uint64_t tail __attribute__((aligned(64)));
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t dropped;
+  bool running;
+  bool stopping;
+  log_format_e format;
+  pthread_t thread;
+  log_out_t *out;
+  log_out_t *err;
+} ring;
+
+static __thread uint32_t thread_id;
+
+static const char *level_names[] = {
+    [LOG_LEVEL_DEBUG] = "debug",
+    [LOG_LEVEL_INFO] = "info",
+    [LOG_LEVEL_WARN] = "warn",
+    [LOG_LEVEL_ERROR] = "error",
+};
+
+int parse_log_format(const char *arg, log_format_e *format) {
+  if (strcmp(arg, "text") == 0) {
+    *format = LOG_FORMAT_TEXT;
+  } else if (strcmp(arg, "json") == 0) {
+    *format = LOG_FORMAT_JSON;
+  } else {
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+static size_t append_json_string(char *buf, size_t size, const char *text,
+                                 size_t len) {
+  size_t n = 0;
+  for (size_t i = 0; i < len && n + 6 < size; i++) {
+    unsigned char c = text[i];
+    if (c == '"' || c == '\\') {
+      buf[n++] = '\\';
+      buf[n++] = c;
+    } else if (c < 0x20) {
+      n += snprintf(buf + n, size - n, "\\u%04x", c);
+    } else {
+      buf[n++] = c;
+    }
+  }
+  return n;
+}
+
+/* Renders one entry with its trailing newline; lines that do not fit are
+   cut short. */
+static size_t format_entry(const log_entry_t *entry, log_format_e format,
+                           char *buf, size_t size) {
+  time_t seconds = entry->time / 1000000000ull;
+  unsigned millis = entry->time / 1000000ull % 1000;
+  struct tm tm;
+  char stamp[32];
+  size_t n;
+
+  gmtime_r(&seconds, &tm);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  if (format == LOG_FORMAT_JSON) {
+    n = snprintf(buf, size,
+                 "{\"ts\":\"%s.%03uZ\",\"level\":\"%s\",\"thread\":%u,"
+                 "\"src\":\"%s:%u\",\"msg\":\"",
+                 stamp, millis, level_names[entry->level], entry->thread,
+                 entry->file, entry->line);
+    if (n + 4 < size) {
+      n += append_json_string(buf + n, size - n - 4, entry->text, entry->len);
+      n += snprintf(buf + n, size - n, "\"}\n");
+    }
+  } else {
+    n = snprintf(buf, size, "%s.%03uZ %-5s [%u] %.*s\n", stamp, millis,
+                 level_names[entry->level], entry->thread, (int)entry->len,
+                 entry->text);
+  }
+
+  if (n >= size) {
+    n = size - 1;
+    buf[n - 1] = '\n';
+  }
+  return n;
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+static void flush_out(log_out_t *out) {
+  write_all(out->fd, out->data, out->len);
+  out->len = 0;
+}
+
+static void emit(const log_entry_t *entry) {
+  log_out_t *out = entry->level >= LOG_LEVEL_WARN ? ring.err : ring.out;
+  if (LOG_OUT_MAX - out->len < 2 * LOG_LINE_MAX) {
+    flush_out(out);
+  }
+  out->len += format_entry(entry, ring.format, out->data + out->len,
+                           LOG_OUT_MAX - out->len);
+}
+
+static log_entry_t *claim_entry(uint64_t *pos_out) {
+  uint64_t pos = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+
+  while (1) {
+    log_entry_t *entry = &ring.entries[pos & (LOG_RING_SLOTS - 1)];
+    uint64_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t)(seq - pos);
+
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&ring.tail, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        *pos_out = pos;
+        return entry;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static size_t drain_ring(void) {
+  size_t drained = 0;
+
+  while (1) {
+    log_entry_t *entry = &ring.entries[ring.head & (LOG_RING_SLOTS - 1)];
+    if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != ring.head + 1) {
+      break;
+    }
+    emit(entry);
+    __atomic_store_n(&entry->seq, ring.head + LOG_RING_SLOTS,
+                     __ATOMIC_RELEASE);
+    ring.head++;
+    drained++;
+  }
+
+  uint64_t dropped = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED);
+  if (dropped > 0) {
+    log_entry_t note = {.level = LOG_LEVEL_WARN, .file = __FILE__,
+                        .line = __LINE__, .thread = thread_id};
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    note.time = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    note.len = snprintf(note.text, sizeof(note.text),
+                        "Log ring full, dropped %lu line(s)", dropped);
+    emit(&note);
+  }
+  return drained;
+}
+
+static void *flusher_main(void *arg) {
+  (void)arg;
+  struct timespec interval = {.tv_sec = 0, .tv_nsec = LOG_FLUSH_INTERVAL_NS};
+
+  while (1) {
+    if (drain_ring() > 0) {
+      continue;
+    }
+    flush_out(ring.out);
+    flush_out(ring.err);
+    if (__atomic_load_n(&ring.stopping, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    nanosleep(&interval, NULL);
+  }
+
+  drain_ring();
+  flush_out(ring.out);
+  flush_out(ring.err);
+  return NULL;
+}
+
+int log_init(log_format_e format) {
+  ring.format = format;
+  ring.entries = aligned_alloc(64, LOG_RING_SLOTS * sizeof(log_entry_t));
+  ring.out = malloc(sizeof(log_out_t));
+  ring.err = malloc(sizeof(log_out_t));
+  if (ring.entries == NULL || ring.out == NULL || ring.err == NULL) {
+    perror("Failed to allocate log ring");
+    goto fail;
+  }
+
+  for (uint64_t i = 0; i < LOG_RING_SLOTS; i++) {
+    ring.entries[i].seq = i;
+  }
+  ring.tail = 0;
+  ring.head = 0;
+  ring.dropped = 0;
+  ring.stopping = false;
+  ring.out->fd = STDOUT_FILENO;
+  ring.out->len = 0;
+  ring.err->fd = STDERR_FILENO;
+  ring.err->len = 0;
+
+  if (pthread_create(&ring.thread, NULL, flusher_main, NULL) != 0) {
+    perror("pthread_create");
+    goto fail;
+  }
+
+  __atomic_store_n(&ring.running, true, __ATOMIC_RELEASE);
+  return STATUS_SUCCESS;
+
+fail:
+  free(ring.entries);
+  free(ring.out);
+  free(ring.err);
+  ring.entries = NULL;
+  ring.out = NULL;
+  ring.err = NULL;
+  return STATUS_ERROR;
+}
+
+/* Drains what is queued. Lines logged afterwards are written directly. */
+void log_shutdown(void) {
+  if (!__atomic_load_n(&ring.running, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+
+  __atomic_store_n(&ring.stopping, true, __ATOMIC_RELEASE);
+  pthread_join(ring.thread, NULL);
+  __atomic_store_n(&ring.running, false, __ATOMIC_RELEASE);
+
+  free(ring.entries);
+  free(ring.out);
+  free(ring.err);
+  ring.entries = NULL;
+  ring.out = NULL;
+  ring.err = NULL;
+}
+
+/* A forked child has the ring but not the flusher thread, so its lines are
+   written directly. */
+void log_detach(void) {
+  __atomic_store_n(&ring.running, false, __ATOMIC_RELEASE);
+}
+
+static void fill_entry(log_entry_t *entry, log_level_e level, uint64_t time,
+                       const char *file, int line, const char *fmt,
+                       va_list args) {
+  entry->time = time;
+  entry->file = file;
+  entry->line = line;
+  entry->level = level;
+  entry->thread = thread_id;
+
+  int n = vsnprintf(entry->text, sizeof(entry->text), fmt, args);
+  if (n < 0) {
+    n = 0;
+  } else if ((size_t)n >= sizeof(entry->text)) {
+    n = sizeof(entry->text) - 1;
+  }
+  entry->len = n;
+}
+
+static void vlog_entry(log_level_e level, uint64_t time, const char *file,
+                       int line, const char *fmt, va_list args) {
+  if (!__atomic_load_n(&ring.running, __ATOMIC_ACQUIRE)) {
+    /* Before log_init or after log_shutdown: write synchronously. */
+    log_entry_t entry;
+    char buf[2 * LOG_LINE_MAX];
+    fill_entry(&entry, level, time, file, line, fmt, args);
+    size_t len = format_entry(&entry, ring.format, buf, sizeof(buf));
+    write_all(level >= LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO, buf,
+              len);
+    return;
+  }
+
+  uint64_t pos;
+  log_entry_t *entry = claim_entry(&pos);
+  if (entry == NULL) {
+    __atomic_add_fetch(&ring.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  fill_entry(entry, level, time, file, line, fmt, args);
+  __atomic_store_n(&entry->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static void log_entry(log_level_e level, uint64_t time, const char *file,
+                      int line, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  vlog_entry(level, time, file, line, fmt, args);
+  va_end(args);
+}
+
+void log_write(log_level_e level, log_limit_t *limit, const char *file,
+               int line, const char *fmt, ...) {
+  int saved_errno = errno;
+  struct timespec ts;
+
+  if (thread_id == 0) {
+    thread_id = gettid();
+  }
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  if (limit->second != (uint64_t)ts.tv_sec) {
+    if (limit->suppressed > 0) {
+      log_entry(LOG_LEVEL_WARN, now, file, line,
+                "Suppressed %u line(s) from this call site", limit->suppressed);
+    }
+    limit->second = ts.tv_sec;
+    limit->count = 0;
+    limit->suppressed = 0;
+  }
+  if (limit->count >= LOG_RATE_LIMIT) {
+    limit->suppressed++;
+    errno = saved_errno;
+    return;
+  }
+  limit->count++;
+
+  /* Restored so %m reports the caller's error. */
+  errno = saved_errno;
+  va_list args;
+  va_start(args, fmt);
+  vlog_entry(level, now, file, line, fmt, args);
+  va_end(args);
+  errno = saved_errno;
+}
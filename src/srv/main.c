@@ -1,29 +1,34 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <asm-generic/socket.h>
 #include <bits/getopt_core.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <netinet/in.h>
-#include <poll.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "common.h"
+#include "db.h"
 #include "file.h"
+#include "log.h"
+#include "metrics.h"
 #include "parse.h"
 #include "srvpoll.h"
 
-#define MAX_CLIENTS 256
-
-clientstate_t clientStates[MAX_CLIENTS] = {0};
-
 void print_usage(char *argv[]) {
   fprintf(stderr,
           "Usage: %s -f <database file> [-n] [-a <name,addr,hours>] [-l]\n",
@@ -36,28 +41,273 @@ void print_usage(char *argv[]) {
   fprintf(stderr, "\t-u <data>          Update employee hours (name,hours)\n");
   fprintf(stderr, "\t-d <name>          Remove employee record (name)\n");
   fprintf(stderr, "\t-l                 List employee records\n");
+  fprintf(stderr, "\t-p <port>          (required) Port to listen on\n");
+  fprintf(stderr,
+          "\t-t <threads>       Number of reactor threads (default 1)\n");
+  fprintf(stderr, "\t-w <policy>        WAL fsync policy: always, batch "
+                  "(default) or none\n");
+  fprintf(stderr, "\t-C <bytes>         Checkpoint once the WAL reaches this "
+                  "size (0 disables)\n");
+  fprintf(stderr, "\t-m                 Access records through a shared "
+                  "memory mapping of the file\n");
+  fprintf(stderr, "\t-c                 Keep a columnar copy of the hours for "
+                  "aggregate queries\n");
+  fprintf(stderr, "\t-M <port>          Serve plain-text metrics on this "
+                  "port\n");
+  fprintf(stderr, "\t-U                 Commit the write-ahead log through "
+                  "io_uring if the kernel supports it\n");
+  fprintf(stderr, "\t-s <secs>/<changes> Save in the background after this "
+                  "many changes and seconds\n");
+  fprintf(stderr, "\t-L <format>        Log format: text (default) or json\n");
+}
+
+/* Tag the io_uring completion eventfd and the reactor's own commit
+   eventfd in epoll_event.data.ptr. */
+static char reap_event;
+static char commit_event;
+
+typedef struct {
+  pthread_t thread;
+  int id;
+  int listen_fd;
+  database_t *db;
+} worker_t;
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    log_error("fcntl: %m");
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
 }
 
-int poll_loop(unsigned short port, dbheader_t *dbhdr, employee_t *employees) {
-  int listen_fd, conn_fd, freeSlot;
-  struct sockaddr_in server_addr, client_addr;
-  socklen_t client_len = sizeof(client_addr);
+static void accept_clients(int epoll_fd, int listen_fd,
+                           clienttable_t *clients) {
+  struct sockaddr_in client_addr;
+  socklen_t client_len;
 
-  struct pollfd fds[MAX_CLIENTS + 1];
-  int nfds = 1;
-  int opt = 1;
+  while (1) {
+    client_len = sizeof(client_addr);
+    int conn_fd = accept4(listen_fd, (struct sockaddr *)&client_addr,
+                          &client_len, SOCK_NONBLOCK);
+    if (conn_fd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        log_error("accept: %m");
+      }
+      return;
+    }
+
+    metrics_accepted();
+    log_debug("New connection from %s:%d", inet_ntoa(client_addr.sin_addr),
+              ntohs(client_addr.sin_port));
+
+    int nodelay = 1;
+    setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    clientstate_t *client = acquire_client(clients, conn_fd);
+    if (client == NULL) {
+      log_warn("Server full: closing new connection");
+      close(conn_fd);
+      continue;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = client;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn_fd, &ev) == -1) {
+      log_error("epoll_ctl: %m");
+      close(conn_fd);
+      release_client(clients, client);
+      continue;
+    }
+
+    log_debug("Slot %zu has fd %d", client->slot, client->fd);
+  }
+}
 
-  init_clients(clientStates);
+static void drain_client(clientstate_t *client, database_t *db) {
+  handle_client_fsm(db, client);
+
+  while (client_wants_input(client)) {
+    uint64_t start = metrics_now();
+    ssize_t bytes_read =
+        read(client->fd, client->buffer + client->bytes_received,
+             client->buffer_size - client->bytes_received);
+    if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (bytes_read == -1 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      close(client->fd);
+      client->fd = -1;
+      client->state = STATE_DISCONNECTED;
+      log_debug("Client disconnected or error");
+      break;
+    }
+
+    metrics_phase(METRIC_RECV, metrics_now() - start);
+    metrics_bytes_in(bytes_read);
+    client->bytes_received += bytes_read;
+    handle_client_fsm(db, client);
+  }
+}
+
+/* Clients with work left after an event, linked through the client state
+   so any number of them can be queued. */
+typedef struct {
+  clientstate_t *head;
+  clientstate_t *tail;
+} pendinglist_t;
+
+static void queue_client(pendinglist_t *pending, clientstate_t *client) {
+  if (!client->queued) {
+    client->queued = true;
+    client->next_pending = NULL;
+    if (pending->tail != NULL) {
+      pending->tail->next_pending = client;
+    } else {
+      pending->head = client;
+    }
+    pending->tail = client;
+  }
+}
+
+/* Clients whose responses wait on a WAL batch, oldest batch first. Each
+   reactor keeps its own, so a completion only touches the clients it
+   releases. */
+typedef struct {
+  clientstate_t *head;
+  clientstate_t *tail;
+} waitlist_t;
+
+static void unwait_client(waitlist_t *waiting, clientstate_t *client) {
+  if (!client->waiting) {
+    return;
+  }
+  if (client->wait_prev != NULL) {
+    client->wait_prev->wait_next = client->wait_next;
+  } else {
+    waiting->head = client->wait_next;
+  }
+  if (client->wait_next != NULL) {
+    client->wait_next->wait_prev = client->wait_prev;
+  } else {
+    waiting->tail = client->wait_prev;
+  }
+  client->waiting = false;
+}
+
+/* Batches only grow, so the insertion point is almost always the tail. */
+static void wait_client(waitlist_t *waiting, clientstate_t *client) {
+  unwait_client(waiting, client);
+
+  clientstate_t *prev = waiting->tail;
+  while (prev != NULL && prev->commit_batch > client->commit_batch) {
+    prev = prev->wait_prev;
+  }
+  client->wait_prev = prev;
+  client->wait_next = prev != NULL ? prev->wait_next : waiting->head;
+  if (client->wait_next != NULL) {
+    client->wait_next->wait_prev = client;
+  } else {
+    waiting->tail = client;
+  }
+  if (prev != NULL) {
+    prev->wait_next = client;
+  } else {
+    waiting->head = client;
+  }
+  client->waiting = true;
+}
+
+/* Responses wait until the WAL batch holding their changes is durable.
+   Clients still waiting drop out of pending into the wait list until
+   queue_committed() finds them after a completion. If the log has failed
+   their batch never will commit, so they are disconnected without the
+   responses. */
+static void flush_pending(clienttable_t *clients, database_t *db,
+                          pendinglist_t *pending, waitlist_t *waiting,
+                          uint64_t target) {
+  uint64_t committed = db_committed(db);
+  bool failed = db_failed(db);
+  clientstate_t *next = pending->head;
+
+  pending->head = NULL;
+  pending->tail = NULL;
+
+  while (next != NULL) {
+    clientstate_t *client = next;
+    next = client->next_pending;
+    client->queued = false;
+
+    bool paused = false;
+    if (client->fd != -1) {
+      paused = !client_wants_input(client);
+      if (client->out_ready < client->out_len &&
+          client->commit_batch < target) {
+        client->commit_batch = target;
+      }
+      if (client->commit_batch <= committed) {
+        release_client_output(client);
+        client->commit_batch = 0;
+      } else if (failed) {
+        log_warn("Client %d: Changes were not committed, disconnecting",
+                 client->fd);
+        close(client->fd);
+        client->fd = -1;
+        client->state = STATE_DISCONNECTED;
+      }
+    }
+
+    if (client->fd != -1) {
+      flush_client_output(db, client);
+    }
+    if (client->fd != -1 && paused && client_wants_input(client)) {
+      drain_client(client, db);
+      if (client->fd != -1 && (client->out_len > 0 || client->listing)) {
+        queue_client(pending, client);
+      }
+    }
+
+    if (client->fd == -1) {
+      unwait_client(waiting, client);
+      release_client(clients, client);
+    } else if (client->commit_batch != 0) {
+      wait_client(waiting, client);
+    } else {
+      unwait_client(waiting, client);
+    }
+  }
+}
+
+static void queue_committed(waitlist_t *waiting, uint64_t committed,
+                            bool failed, pendinglist_t *pending) {
+  while (waiting->head != NULL &&
+         (failed || waiting->head->commit_batch <= committed)) {
+    clientstate_t *client = waiting->head;
+    unwait_client(waiting, client);
+    queue_client(pending, client);
+  }
+}
+
+static int open_listen_socket(unsigned short port) {
+  int listen_fd;
+  struct sockaddr_in server_addr;
+  int opt = 1;
 
   if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-    perror("socket");
-    exit(EXIT_FAILURE);
+    log_error("socket: %m");
+    return STATUS_ERROR;
   }
 
-  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-    perror("setsockopt");
+  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+      setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    log_error("setsockopt: %m");
     close(listen_fd);
-    exit(EXIT_FAILURE);
+    return STATUS_ERROR;
   }
 
   memset(&server_addr, 0, sizeof(server_addr));
@@ -67,107 +317,240 @@ int poll_loop(unsigned short port, dbheader_t *dbhdr, employee_t *employees) {
 
   if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) ==
       -1) {
-    perror("bind");
-    exit(EXIT_FAILURE);
+    log_error("bind: %m");
+    close(listen_fd);
+    return STATUS_ERROR;
   }
 
-  if (listen(listen_fd, 10) == -1) {
-    perror("listen");
-    exit(EXIT_FAILURE);
+  if (listen(listen_fd, SOMAXCONN) == -1) {
+    log_error("listen: %m");
+    close(listen_fd);
+    return STATUS_ERROR;
   }
 
-  printf("Server listening on port %d\n", port);
+  if (set_nonblocking(listen_fd) != STATUS_SUCCESS) {
+    close(listen_fd);
+    return STATUS_ERROR;
+  }
 
-  memset(fds, 0, sizeof(fds));
-  fds[0].fd = listen_fd;
-  fds[0].events = POLLIN;
-  nfds = 1;
+  return listen_fd;
+}
 
-  while (1) {
-    int ii = 1;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-      if (clientStates[i].fd != -1) {
-        fds[ii].fd = clientStates[i].fd;
-        fds[ii].events = POLLIN;
-        ii++;
-      }
-    }
+static int watch_fd(int epoll_fd, int fd, uint32_t events, void *tag) {
+  struct epoll_event ev = {0};
+  ev.events = events;
+  ev.data.ptr = tag;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    log_error("epoll_ctl: %m");
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+int poll_loop(int listen_fd, database_t *db) {
+  int epoll_fd;
+  struct epoll_event events[MAX_EVENTS];
+  pendinglist_t pending = {NULL, NULL};
+  waitlist_t waiting = {NULL, NULL};
+  wal_waiter_t waiter = {-1, 0};
+  clienttable_t clients;
+
+  if (init_client_table(&clients, CLIENT_TABLE_INIT) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
 
-    int n_events = poll(fds, nfds, -1);
+  if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+    log_error("epoll_create1: %m");
+    free_client_table(&clients);
+    return STATUS_ERROR;
+  }
+
+  waiter.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (waiter.event_fd == -1) {
+    log_error("eventfd: %m");
+    goto close_epoll;
+  }
+  if (db_add_waiter(db, &waiter) != STATUS_SUCCESS) {
+    goto close_waiter;
+  }
+
+  if (watch_fd(epoll_fd, listen_fd, EPOLLIN | EPOLLET, NULL) !=
+          STATUS_SUCCESS ||
+      watch_fd(epoll_fd, waiter.event_fd, EPOLLIN | EPOLLET, &commit_event) !=
+          STATUS_SUCCESS) {
+    goto remove_waiter;
+  }
+
+  /* Level-triggered and exclusive: one reactor wakes, drains the eventfd
+     and reaps the completions, which signals the reactors they release. */
+  int reap_fd = db_commit_fd(db);
+  if (reap_fd >= 0 && watch_fd(epoll_fd, reap_fd, EPOLLIN | EPOLLEXCLUSIVE,
+                               &reap_event) != STATUS_SUCCESS) {
+    goto remove_waiter;
+  }
+
+  bool reap = false;
+  bool committed = false;
+  eventfd_t count;
+
+  while (1) {
+    int n_events = epoll_wait(epoll_fd, events, MAX_EVENTS,
+                              pending.head != NULL || committed ? 0 : -1);
     if (n_events == -1) {
-      perror("poll");
-      exit(EXIT_FAILURE);
+      if (errno == EINTR)
+        continue;
+      log_error("epoll_wait: %m");
+      break;
     }
 
-    if (fds[0].revents & POLLIN) {
-      if ((conn_fd = accept(listen_fd, (struct sockaddr *)&client_addr,
-                            &client_len)) == -1) {
-        perror("accept");
+    for (int i = 0; i < n_events; i++) {
+      clientstate_t *client = events[i].data.ptr;
+
+      if (client == NULL) {
+        accept_clients(epoll_fd, listen_fd, &clients);
+        continue;
+      }
+      if (events[i].data.ptr == &reap_event) {
+        eventfd_read(reap_fd, &count);
+        reap = true;
+        continue;
+      }
+      if (events[i].data.ptr == &commit_event) {
+        eventfd_read(waiter.event_fd, &count);
+        committed = true;
         continue;
       }
 
-      printf("New connection from %s:%d\n", inet_ntoa(client_addr.sin_addr),
-             ntohs(client_addr.sin_port));
-
-      freeSlot = find_free_slot(clientStates);
-      if (freeSlot == -1) {
-        printf("Server full: closing new connection\n");
-        close(conn_fd);
-      } else {
-        clientStates[freeSlot].fd = conn_fd;
-        clientStates[freeSlot].state = STATE_CONNECTED;
-        nfds++;
-        printf("Slot %d has fd %d\n", freeSlot, clientStates[freeSlot].fd);
+      if (events[i].events & EPOLLOUT) {
+        flush_client_output(db, client);
       }
+      drain_client(client, db);
+      queue_client(&pending, client);
+    }
 
-      n_events--;
+    if (reap) {
+      db_reap(db);
+      reap = false;
     }
+    uint64_t target = db_submit(db);
+    if (committed) {
+      queue_committed(&waiting, db_committed(db), db_failed(db), &pending);
+    }
+    flush_pending(&clients, db, &pending, &waiting, target);
+    committed = db_watch(db, &waiter, waiting.head != NULL
+                                          ? waiting.head->commit_batch
+                                          : 0);
+  }
 
-    for (int i = 1; i <= nfds && n_events > 0; i++) {
-      if (fds[i].revents & POLLIN) {
-        n_events--;
-
-        int fd = fds[i].fd;
-        int slot = find_slot_by_fd(clientStates, fd);
-        ssize_t bytes_read = read(fd, &clientStates[slot].buffer,
-                                  sizeof(clientStates[slot].buffer) - 1);
-        if (bytes_read <= 0) {
-          close(fd);
-          if (slot == -1) {
-            printf("Tried to close fd that doesnt exist?\n");
-          } else {
-            clientStates[slot].fd = -1;
-            clientStates[slot].state = STATE_DISCONNECTED;
-            printf("Client disconnected or error\n");
-            nfds--;
-          }
-        } else {
-          handle_client_fsm(dbhdr, &employees, &clientStates[slot], fd);
-        }
-      }
+remove_waiter:
+  db_remove_waiter(db, &waiter);
+close_waiter:
+  close(waiter.event_fd);
+close_epoll:
+  free_client_table(&clients);
+  close(epoll_fd);
+  return STATUS_ERROR;
+}
+
+static void *worker_main(void *arg) {
+  worker_t *worker = arg;
+  metrics_attach(worker->id);
+  poll_loop(worker->listen_fd, worker->db);
+  return NULL;
+}
+
+static int run_workers(unsigned short port, int nthreads, database_t *db) {
+  worker_t *workers = calloc(nthreads, sizeof(worker_t));
+  if (workers == NULL) {
+    log_error("Failed to allocate workers: %m");
+    return STATUS_ERROR;
+  }
+
+  int ret = STATUS_SUCCESS;
+  int started = 0;
+
+  for (int i = 0; i < nthreads; i++) {
+    workers[i].listen_fd = -1;
+  }
+
+  for (int i = 0; i < nthreads; i++) {
+    workers[i].id = i;
+    workers[i].db = db;
+    workers[i].listen_fd = open_listen_socket(port);
+    if (workers[i].listen_fd == STATUS_ERROR) {
+      ret = STATUS_ERROR;
+      goto join;
+    }
+  }
+
+  log_info("Server listening on port %d with %d reactor thread(s)", port,
+           nthreads);
+
+  for (int i = 1; i < nthreads; i++) {
+    if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) !=
+        0) {
+      log_error("pthread_create: %m");
+      ret = STATUS_ERROR;
+      goto join;
+    }
+    started++;
+  }
+
+  metrics_attach(0);
+  ret = poll_loop(workers[0].listen_fd, db);
+
+join:
+  for (int i = 1; i <= started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  for (int i = 0; i < nthreads; i++) {
+    if (workers[i].listen_fd >= 0) {
+      close(workers[i].listen_fd);
     }
   }
-  return 0;
+  free(workers);
+  return ret;
 }
 
 int main(int argc, char *argv[]) {
   char *filepath = NULL;
   char *portarg = NULL;
   unsigned short port = 0;
+  unsigned short metrics_port = 0;
+  log_format_e log_format = LOG_FORMAT_TEXT;
   bool newfile = false;
   bool list = false;
   int c;
   int ret = EXIT_FAILURE;
 
-  int dbfd = -1;
-  dbheader_t *dbhdr = NULL;
-  employee_t *employees = NULL;
-
-  while ((c = getopt(argc, argv, "nf:p:")) != -1) {
+  int nthreads = 1;
+
+  database_t db = {.hdr = NULL,
+                   .records = NULL,
+                   .fd = -1,
+                   .wal = NULL,
+                   .lock = PTHREAD_RWLOCK_INITIALIZER};
+  dbconfig_t config = {.sync = WAL_SYNC_BATCH,
+                       .checkpoint_bytes = WAL_CHECKPOINT_BYTES,
+                       .mmap = false,
+                       .columnar = false,
+                       .uring = false,
+                       .save = {0}};
+
+  while ((c = getopt(argc, argv, "nmcUf:p:t:w:C:M:L:s:")) != -1) {
     switch (c) {
     case 'n':
       newfile = true;
       break;
+    case 'm':
+      config.mmap = true;
+      break;
+    case 'c':
+      config.columnar = true;
+      break;
+    case 'U':
+      config.uring = true;
+      break;
     case 'f':
       filepath = optarg;
       break;
@@ -178,6 +561,41 @@ int main(int argc, char *argv[]) {
         printf("Bad port: %s\n", portarg);
       }
       break;
+    case 't':
+      nthreads = atoi(optarg);
+      if (nthreads <= 0) {
+        printf("Bad thread count: %s\n", optarg);
+        goto cleanup;
+      }
+      break;
+    case 'w':
+      if (parse_wal_sync(optarg, &config.sync) != STATUS_SUCCESS) {
+        printf("Bad WAL sync policy: %s\n", optarg);
+        goto cleanup;
+      }
+      break;
+    case 'C':
+      config.checkpoint_bytes = strtoul(optarg, NULL, 10);
+      break;
+    case 'M':
+      metrics_port = atoi(optarg);
+      if (metrics_port == 0) {
+        printf("Bad metrics port: %s\n", optarg);
+        goto cleanup;
+      }
+      break;
+    case 's':
+      if (parse_save_policy(optarg, &config.save) != STATUS_SUCCESS) {
+        printf("Bad save policy: %s\n", optarg);
+        goto cleanup;
+      }
+      break;
+    case 'L':
+      if (parse_log_format(optarg, &log_format) != STATUS_SUCCESS) {
+        printf("Bad log format: %s\n", optarg);
+        goto cleanup;
+      }
+      break;
     case '?':
       print_usage(argv);
       goto cleanup;
@@ -201,57 +619,32 @@ int main(int argc, char *argv[]) {
     goto cleanup;
   }
 
-  if (newfile) {
-    dbfd = create_db_file(filepath);
-    if (dbfd == STATUS_ERROR) {
-      goto cleanup;
-    }
-
-    if (create_db_header(dbfd, &dbhdr) == STATUS_ERROR) {
-      goto cleanup;
-    }
-  } else {
-    dbfd = open_db_file(filepath);
-    if (dbfd == STATUS_ERROR) {
-      goto cleanup;
-    }
+  if (log_init(log_format) != STATUS_SUCCESS) {
+    goto cleanup;
+  }
 
-    if (validate_db_header(dbfd, &dbhdr) == STATUS_ERROR) {
-      goto cleanup;
-    }
+  /* Before db_open(), which starts the saver thread. */
+  if (metrics_init(nthreads) != STATUS_SUCCESS) {
+    goto cleanup;
   }
 
-  if (read_employees(dbfd, dbhdr, &employees) != STATUS_SUCCESS) {
+  if (db_open(&db, filepath, newfile, &config) != STATUS_SUCCESS) {
     goto cleanup;
   }
 
-  if (poll_loop(port, dbhdr, employees) != STATUS_SUCCESS) {
+  if (metrics_port != 0 && metrics_listen(metrics_port) != STATUS_SUCCESS) {
     goto cleanup;
-  };
+  }
 
-  if (output_file(dbfd, dbhdr, employees) != STATUS_SUCCESS) {
+  if (run_workers(port, nthreads, &db) != STATUS_SUCCESS) {
     goto cleanup;
   };
 
   ret = EXIT_SUCCESS;
 
 cleanup:
-  if (dbhdr != NULL) {
-    free(dbhdr);
-    dbhdr = NULL;
-  }
-  if (employees != NULL) {
-    free(employees);
-    employees = NULL;
-  }
-
-  if (dbfd >= 0) {
-    if (close(dbfd) == -1) {
-      perror("Error closing file descriptor");
-      ret = EXIT_FAILURE;
-    }
-    dbfd = -1;
-  }
+  db_close(&db);
+  log_shutdown();
 
   return ret;
 }
@@ -0,0 +1,336 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+
+#define METRICS_REQUEST_MAX 1024
+
+static metrics_slot_t **slots;
+static int slot_count;
+static int reactor_count;
+static __thread metrics_slot_t *self;
+
+static const char *message_names[MSG_TYPE_COUNT] = {
+    [MSG_HELLO_REQ] = "hello",
+    [MSG_EMPLOYEE_LIST_REQ] = "list",
+    [MSG_EMPLOYEE_ADD_REQ] = "add",
+    [MSG_EMPLOYEE_DEL_REQ] = "delete",
+    [MSG_EMPLOYEE_ADD_BATCH_REQ] = "add_batch",
+    [MSG_EMPLOYEE_STATS_REQ] = "hours_stats",
+    [MSG_EMPLOYEE_QUERY_REQ] = "query",
+    [MSG_EMPLOYEE_RANGE_REQ] = "range",
+    [MSG_EMPLOYEE_UPDATE_REQ] = "update",
+    [MSG_STATS_REQ] = "metrics",
+    [MSG_SAVE_REQ] = "save",
+};
+
+static const char *phase_names[METRIC_PHASES] = {
+    [METRIC_RECV] = "recv",
+    [METRIC_PARSE] = "parse",
+    [METRIC_COMMIT] = "wal_commit",
+    [METRIC_CHECKPOINT] = "checkpoint",
+    [METRIC_SEND] = "send",
+    [METRIC_SAVE_PAUSE] = "save_pause",
+    [METRIC_SAVE] = "background_save",
+};
+
+static const double quantiles[] = {50.0, 90.0, 99.0, 99.9};
+
+/* Counters have a single writer, like the histograms inside them. */
+static inline void add_relaxed(uint64_t *counter, uint64_t value) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                   __ATOMIC_RELAXED);
+}
+
+static inline uint64_t load_relaxed(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void init_metric(metric_t *metric) {
+  metric->count = 0;
+  metric->errors = 0;
+  hist_init(&metric->latency);
+}
+
+/* Call before any thread attaches; the last slot is the saver's. */
+int metrics_init(int nreactors) {
+  int nslots = nreactors + 1;
+
+  reactor_count = nreactors;
+  slots = calloc(nslots, sizeof(metrics_slot_t *));
+  if (slots == NULL) {
+    log_error("Failed to allocate metrics: %m");
+    return STATUS_ERROR;
+  }
+
+  for (int i = 0; i < nslots; i++) {
+    metrics_slot_t *slot = aligned_alloc(64, sizeof(metrics_slot_t));
+    if (slot == NULL) {
+      log_error("Failed to allocate metrics: %m");
+      return STATUS_ERROR;
+    }
+    for (int t = 0; t < MSG_TYPE_COUNT; t++) {
+      init_metric(&slot->messages[t]);
+    }
+    for (int p = 0; p < METRIC_PHASES; p++) {
+      init_metric(&slot->phases[p]);
+    }
+    slot->bytes_in = 0;
+    slot->bytes_out = 0;
+    slot->accepted = 0;
+    slots[i] = slot;
+    slot_count = i + 1;
+  }
+  return STATUS_SUCCESS;
+}
+
+void metrics_attach(int slot) {
+  if (slot < reactor_count && slot < slot_count) {
+    self = slots[slot];
+  }
+}
+
+void metrics_attach_saver(void) {
+  if (reactor_count < slot_count) {
+    self = slots[reactor_count];
+  }
+}
+
+uint64_t metrics_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void record(metric_t *metric, uint64_t elapsed, bool ok) {
+  add_relaxed(&metric->count, 1);
+  if (!ok) {
+    add_relaxed(&metric->errors, 1);
+  }
+  hist_record(&metric->latency, elapsed);
+}
+
+void metrics_message(u_int16_t type, uint64_t elapsed, bool ok) {
+  if (self != NULL && type < MSG_TYPE_COUNT) {
+    record(&self->messages[type], elapsed, ok);
+  }
+}
+
+void metrics_phase(metric_phase_e phase, uint64_t elapsed) {
+  if (self != NULL) {
+    record(&self->phases[phase], elapsed, true);
+  }
+}
+
+void metrics_bytes_in(size_t bytes) {
+  if (self != NULL) {
+    add_relaxed(&self->bytes_in, bytes);
+  }
+}
+
+void metrics_bytes_out(size_t bytes) {
+  if (self != NULL) {
+    add_relaxed(&self->bytes_out, bytes);
+  }
+}
+
+void metrics_accepted(void) {
+  if (self != NULL) {
+    add_relaxed(&self->accepted, 1);
+  }
+}
+
+static void appendf(char *buf, size_t size, size_t *len, const char *fmt,
+                    ...) {
+  if (*len >= size) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf + *len, size - *len, fmt, args);
+  va_end(args);
+
+  if (n > 0) {
+    *len = *len + n < size ? *len + n : size;
+  }
+}
+
+static uint64_t sum_counter(size_t offset) {
+  uint64_t total = 0;
+  for (int i = 0; i < slot_count; i++) {
+    total += load_relaxed((const uint64_t *)((const char *)slots[i] + offset));
+  }
+  return total;
+}
+
+static void merge_metric(size_t offset, metric_t *out) {
+  init_metric(out);
+  for (int i = 0; i < slot_count; i++) {
+    const metric_t *metric =
+        (const metric_t *)((const char *)slots[i] + offset);
+    out->count += load_relaxed(&metric->count);
+    out->errors += load_relaxed(&metric->errors);
+    hist_merge(&out->latency, &metric->latency);
+  }
+}
+
+static void format_latency(char *buf, size_t size, size_t *len,
+                           const char *family, const char *label,
+                           const char *value, const hist_t *latency) {
+  for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+    appendf(buf, size, len, "%s{%s=\"%s\",quantile=\"%g\"} %.1f\n", family,
+            label, value, quantiles[q] / 100.0,
+            hist_percentile(latency, quantiles[q]) / 1000.0);
+  }
+  appendf(buf, size, len, "%s_max{%s=\"%s\"} %.1f\n", family, label, value,
+          latency->max / 1000.0);
+  appendf(buf, size, len, "%s_sum{%s=\"%s\"} %.1f\n", family, label, value,
+          latency->sum / 1000.0);
+}
+
+/* Prometheus text exposition, latencies in microseconds. Only message types
+   and phases that have been seen are listed. */
+size_t metrics_format(char *buf, size_t size) {
+  metric_t *merged = malloc(sizeof(metric_t));
+  size_t len = 0;
+
+  if (merged == NULL) {
+    log_error("Failed to allocate metrics: %m");
+    return 0;
+  }
+
+  appendf(buf, size, &len, "dbserver_threads %d\n", reactor_count);
+  appendf(buf, size, &len, "dbserver_connections_accepted_total %lu\n",
+          sum_counter(offsetof(metrics_slot_t, accepted)));
+  appendf(buf, size, &len, "dbserver_bytes_received_total %lu\n",
+          sum_counter(offsetof(metrics_slot_t, bytes_in)));
+  appendf(buf, size, &len, "dbserver_bytes_sent_total %lu\n",
+          sum_counter(offsetof(metrics_slot_t, bytes_out)));
+
+  for (int t = 0; t < MSG_TYPE_COUNT; t++) {
+    merge_metric(offsetof(metrics_slot_t, messages) + t * sizeof(metric_t),
+                 merged);
+    if (merged->count == 0) {
+      continue;
+    }
+    char name[16];
+    if (message_names[t] != NULL) {
+      snprintf(name, sizeof(name), "%s", message_names[t]);
+    } else {
+      snprintf(name, sizeof(name), "type_%d", t);
+    }
+    appendf(buf, size, &len, "dbserver_requests_total{type=\"%s\"} %lu\n",
+            name, merged->count);
+    appendf(buf, size, &len,
+            "dbserver_request_errors_total{type=\"%s\"} %lu\n", name,
+            merged->errors);
+    format_latency(buf, size, &len, "dbserver_request_latency_us", "type",
+                   name, &merged->latency);
+  }
+
+  for (int p = 0; p < METRIC_PHASES; p++) {
+    merge_metric(offsetof(metrics_slot_t, phases) + p * sizeof(metric_t),
+                 merged);
+    if (merged->count == 0) {
+      continue;
+    }
+    appendf(buf, size, &len, "dbserver_phase_total{phase=\"%s\"} %lu\n",
+            phase_names[p], merged->count);
+    format_latency(buf, size, &len, "dbserver_phase_latency_us", "phase",
+                   phase_names[p], &merged->latency);
+  }
+
+  free(merged);
+  return len;
+}
+
+static void serve_metrics(int fd, char *text) {
+  char request[METRICS_REQUEST_MAX];
+  struct timeval timeout = {.tv_sec = 0, .tv_usec = 200000};
+  char header[128];
+
+  /* Answer anything, but let an HTTP client finish sending its request
+     first so closing the socket does not reset the connection. */
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (read(fd, request, sizeof(request)) < 0) {
+    return;
+  }
+
+  size_t len = metrics_format(text, METRICS_TEXT_MAX);
+  int header_len = snprintf(header, sizeof(header),
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n\r\n",
+                            len);
+  if (write(fd, header, header_len) == header_len) {
+    write(fd, text, len);
+  }
+}
+
+static void *metrics_main(void *arg) {
+  int listen_fd = (int)(intptr_t)arg;
+  char *text = malloc(METRICS_TEXT_MAX);
+  if (text == NULL) {
+    log_error("Failed to allocate metrics buffer: %m");
+    close(listen_fd);
+    return NULL;
+  }
+
+  while (1) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+      log_error("metrics accept: %m");
+      continue;
+    }
+    serve_metrics(fd, text);
+    close(fd);
+  }
+  return NULL;
+}
+
+int metrics_listen(unsigned short port) {
+  struct sockaddr_in addr = {0};
+  int opt = 1;
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd == -1) {
+    log_error("socket: %m");
+    return STATUS_ERROR;
+  }
+
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = INADDR_ANY;
+  addr.sin_port = htons(port);
+
+  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+      bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(listen_fd, SOMAXCONN) == -1) {
+    log_error("Failed to open metrics port: %m");
+    close(listen_fd);
+    return STATUS_ERROR;
+  }
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, metrics_main,
+                     (void *)(intptr_t)listen_fd) != 0) {
+    log_error("pthread_create: %m");
+    close(listen_fd);
+    return STATUS_ERROR;
+  }
+  pthread_detach(thread);
+
+  log_info("Metrics listening on port %d", port);
+  return STATUS_SUCCESS;
+}
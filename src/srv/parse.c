@@ -1,4 +1,7 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
+#include <endian.h>
 #include <errno.h>
 #include <limits.h>
 #include <netinet/in.h>
@@ -7,376 +10,1024 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "common.h"
+#include "crc32.h"
+#include "file.h"
+#include "log.h"
 #include "parse.h"
+#include "wal.h"
+
+#define RECORD_CHUNK 256
+#define SNAPSHOT_STAGING (1024 * 1024)
+
+static long find_employee_index(database_t *db, const char *name) {
+  if (!db->records || !name) {
+    return STATUS_ERROR;
+  }
+  return nameindex_find(&db->index, db, name);
+}
+
+static void encode_db_header(const dbheader_t *dbhdr, dbheader_t *out) {
+  out->magic = htonl(dbhdr->magic);
+  out->version = htons(HEADER_VERSION);
+  out->flags = htons(dbhdr->flags);
+  out->count = htobe64(dbhdr->count);
+  out->filesize = htobe64(dbhdr->filesize);
+  out->strings_offset = htobe64(dbhdr->strings_offset);
+  out->strings_size = htobe64(dbhdr->strings_size);
+  out->record_size = htonl(sizeof(dbrecord_t));
+  out->checksum = 0;
+  out->checksum = htonl(crc32_update(0, out, sizeof(*out)));
+}
+
+static int decode_db_header(dbheader_t *header) {
+  uint32_t stored_checksum = ntohl(header->checksum);
+  header->checksum = 0;
+  if (crc32_update(0, header, sizeof(dbheader_t)) != stored_checksum) {
+    log_error("Corrupted database. Header checksum mismatch.");
+    return STATUS_ERROR;
+  }
+
+  header->magic = ntohl(header->magic);
+  header->version = ntohs(header->version);
+  header->flags = ntohs(header->flags);
+  header->count = be64toh(header->count);
+  header->filesize = be64toh(header->filesize);
+  header->strings_offset = be64toh(header->strings_offset);
+  header->strings_size = be64toh(header->strings_size);
+  header->record_size = ntohl(header->record_size);
+  header->checksum = stored_checksum;
+  return STATUS_SUCCESS;
+}
+
+static void record_to_be(const dbrecord_t *in, dbrecord_t *out) {
+  out->name_off = htonl(in->name_off);
+  out->address_off = htonl(in->address_off);
+  out->name_len = htons(in->name_len);
+  out->address_len = htons(in->address_len);
+  out->hours = htonl(in->hours);
+}
+
+static void record_from_be(dbrecord_t *rec) {
+  rec->name_off = ntohl(rec->name_off);
+  rec->address_off = ntohl(rec->address_off);
+  rec->name_len = ntohs(rec->name_len);
+  rec->address_len = ntohs(rec->address_len);
+  rec->hours = ntohl(rec->hours);
+}
+
+static int pread_full(int fd, void *data, size_t size, off_t offset) {
+  unsigned char *p = data;
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return STATUS_ERROR;
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return STATUS_SUCCESS;
+}
+
+static int pwrite_full(int fd, const void *data, size_t size, off_t offset) {
+  const unsigned char *p = data;
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return STATUS_ERROR;
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return STATUS_SUCCESS;
+}
+
+bool span_next_field(span_t *input, char sep, span_t *field) {
+  if (input->ptr == NULL) {
+    return false;
+  }
+
+  const char *end = memchr(input->ptr, sep, input->len);
+  field->ptr = input->ptr;
+  if (end == NULL) {
+    field->len = input->len;
+    input->ptr = NULL;
+    input->len = 0;
+  } else {
+    field->len = end - input->ptr;
+    input->ptr = end + 1;
+    input->len -= field->len + 1;
+  }
+  return true;
+}
+
+int span_parse_uint(span_t digits, unsigned int *out) {
+  uint64_t value = 0;
 
-static int find_employee_index(dbheader_t *dbhdr, employee_t *employees,
-                               const char *name) {
-  if (!employees || !name) {
+  while (digits.len > 0 && (*digits.ptr == ' ' || *digits.ptr == '\t')) {
+    digits.ptr++;
+    digits.len--;
+  }
+  if (digits.len > 0 && *digits.ptr == '+') {
+    digits.ptr++;
+    digits.len--;
+  }
+
+  if (digits.len == 0 || digits.len > 10) {
     return STATUS_ERROR;
   }
-  for (int i = 0; i < dbhdr->count; i++) {
-    if (strcmp(employees[i].name, name) == 0) {
-      return i;
+
+  for (size_t i = 0; i < digits.len; i++) {
+    unsigned int d = (unsigned char)digits.ptr[i] - '0';
+    if (d > 9) {
+      return STATUS_ERROR;
     }
+    value = value * 10 + d;
   }
-  return STATUS_ERROR;
+
+  if (value > UINT_MAX) {
+    return STATUS_ERROR;
+  }
+  *out = (unsigned int)value;
+  return STATUS_SUCCESS;
 }
 
-static int parse_and_validate_hours(const char *hours_str,
-                                    unsigned int *out_hours) {
-  if (!hours_str || !out_hours) {
+int parse_employee_span(span_t input, employee_t *out) {
+  span_t name, addr, hours;
+  unsigned int parsed_hours;
+
+  if (!span_next_field(&input, ',', &name) ||
+      !span_next_field(&input, ',', &addr) ||
+      !span_next_field(&input, ',', &hours) || name.len == 0 ||
+      name.len >= sizeof(out->name) || addr.len >= sizeof(out->address)) {
+    log_warn("Invalid format for add string. Expected 'name, address,hours'.");
     return STATUS_ERROR;
   }
 
-  char *endptr;
-  errno = 0;
-  long hours_val = strtol(hours_str, &endptr, 10);
+  if (span_parse_uint(hours, &parsed_hours) != STATUS_SUCCESS) {
+    log_warn("Hours string '%.*s' is not a valid number.", (int)hours.len,
+             hours.ptr);
+    return STATUS_ERROR;
+  }
 
-  if (errno != 0 || endptr == hours_str || *endptr != '\0' || hours_val < 0 ||
-      hours_val > UINT_MAX) {
-    if (errno != 0)
-      perror("Error converting hours string (range)");
-    else if (endptr == hours_str)
-      fprintf(stderr, "Error: Hours string '%s' is not a valid number.\n",
-              hours_str);
-    else if (*endptr != '\0')
-      fprintf(stderr, "Error: Trailing character after hours number: '%s'\n",
-              endptr);
-    else
-      fprintf(stderr, "Error: Hours value %ld out of range for unsigned int.\n",
-              hours_val);
+  memset(out, 0, sizeof(*out));
+  memcpy(out->name, name.ptr, name.len);
+  memcpy(out->address, addr.ptr, addr.len);
+  out->hours = parsed_hours;
+  return STATUS_SUCCESS;
+}
+
+int parse_update_span(span_t input, span_t *name, unsigned int *hours) {
+  span_t hours_str;
+
+  if (!span_next_field(&input, ',', name) ||
+      !span_next_field(&input, ',', &hours_str) || name->len == 0) {
+    log_warn("Invalid format for update string. Expected 'name, hours'.");
     return STATUS_ERROR;
   }
 
-  *out_hours = (unsigned int)hours_val;
+  if (span_parse_uint(hours_str, hours) != STATUS_SUCCESS) {
+    log_warn("Hours string '%.*s' is not a valid number.", (int)hours_str.len,
+             hours_str.ptr);
+    return STATUS_ERROR;
+  }
   return STATUS_SUCCESS;
 }
 
-void list_employees(dbheader_t *dbhdr, employee_t *employees) {
-  for (int i = 0; i < dbhdr->count; i++) {
-    printf("Employee %d\n", i);
-    printf("\tName: %s\n", employees[i].name);
-    printf("\tAddress: %s\n", employees[i].address);
-    printf("\tHours: %d\n", employees[i].hours);
+int parse_employee(char *addstring, employee_t *out) {
+  span_t input = {addstring, strlen(addstring)};
+  return parse_employee_span(input, out);
+}
+
+int employee_from_wire(const wire_employee_t *in, employee_t *out) {
+  if (in->name_len == 0 || in->name_len >= sizeof(out->name) ||
+      in->address_len >= sizeof(out->address) ||
+      memchr(in->name, '\0', in->name_len) != NULL ||
+      memchr(in->address, '\0', in->address_len) != NULL) {
+    return STATUS_ERROR;
   }
+
+  memset(out, 0, sizeof(*out));
+  memcpy(out->name, in->name, in->name_len);
+  memcpy(out->address, in->address, in->address_len);
+  out->hours = in->hours;
+  return STATUS_SUCCESS;
 }
 
-int add_employee(dbheader_t *dbhdr, employee_t **employees_ptr,
-                 char *addstring) {
-  dbhdr->count++;
-  employee_t *tmp = realloc(*employees_ptr, dbhdr->count * sizeof(employee_t));
+int make_record(database_t *db, const char *name, size_t name_len,
+                const char *address, size_t address_len, unsigned int hours,
+                dbrecord_t *out) {
+  if (name_len > RECORD_STRING_MAX || address_len > RECORD_STRING_MAX) {
+    log_warn("Employee strings are too long to store.");
+    return STATUS_ERROR;
+  }
 
-  if (tmp == NULL && dbhdr->count > 0) {
-    perror("Error: Failed to reallocate memory for new employee");
-    dbhdr->count--;
+  /* Reserved together so a failure cannot leave the name behind as
+     garbage the dead count never sees. */
+  if (strarena_reserve(&db->strings, name_len + address_len + 2, 2) !=
+          STATUS_SUCCESS ||
+      strarena_intern(&db->strings, name, name_len, &out->name_off) !=
+          STATUS_SUCCESS ||
+      strarena_intern(&db->strings, address, address_len,
+                      &out->address_off) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
-  *employees_ptr = tmp;
+  out->name_len = name_len;
+  out->address_len = address_len;
+  out->hours = hours;
+  return STATUS_SUCCESS;
+}
 
-  char *input_copy = strdup(addstring);
-  if (!input_copy) {
-    perror("Failed to duplicate addstring");
-    dbhdr->count--;
+static int write_disk_layout(database_t *db, uint64_t strings_offset) {
+  dbheader_t header;
+  if (pread_full(db->fd, &header, sizeof(header), 0) != STATUS_SUCCESS ||
+      decode_db_header(&header) != STATUS_SUCCESS) {
+    log_error("Failed to read back database header");
     return STATUS_ERROR;
   }
 
-  char *name = strtok(input_copy, ",");
-  char *addr = strtok(NULL, ",");
-  char *hours_str = strtok(NULL, ",");
+  header.strings_offset = strings_offset;
+  header.filesize = strings_offset + header.strings_size;
 
-  if (name == NULL || addr == NULL || hours_str == NULL) {
-    fprintf(stderr, "Error: Invalid format for add string. Expected 'name, "
-                    "address,hours'.\n");
-    free(input_copy);
-    dbhdr->count--;
+  dbheader_t header_to_write;
+  encode_db_header(&header, &header_to_write);
+  if (pwrite_full(db->fd, &header_to_write, sizeof(header_to_write), 0) !=
+          STATUS_SUCCESS ||
+      fdatasync(db->fd) == -1) {
+    log_error("Failed to write header: %m");
     return STATUS_ERROR;
   }
+  return STATUS_SUCCESS;
+}
 
-  unsigned int parsed_hours;
-  if (parse_and_validate_hours(hours_str, &parsed_hours) != STATUS_SUCCESS) {
-    free(input_copy);
-    dbhdr->count--;
+/* The string arena sits right after the mapped records, so growing the
+   mapping first copies the synced arena past the new record area and only
+   then points the on-disk header at the copy. */
+static int remap_employees(database_t *db, size_t capacity) {
+  size_t synced = db->strings_synced;
+  size_t min_off = db->hdr->strings_offset + synced;
+  size_t new_off = sizeof(dbheader_t) + capacity * sizeof(dbrecord_t);
+
+  if (new_off < min_off) {
+    capacity = (min_off - sizeof(dbheader_t) + sizeof(dbrecord_t) - 1) /
+               sizeof(dbrecord_t);
+    new_off = sizeof(dbheader_t) + capacity * sizeof(dbrecord_t);
+  }
+
+  if (pwrite_full(db->fd, db->strings.data, synced, new_off) !=
+          STATUS_SUCCESS ||
+      fdatasync(db->fd) == -1) {
+    log_error("Failed to relocate string arena: %m");
+    return STATUS_ERROR;
+  }
+  if (write_disk_layout(db, new_off) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
 
-  employee_t *employees = *employees_ptr;
+  void *map = mremap(db->map, db->map_len, new_off, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED) {
+    log_error("Failed to remap database file: %m");
+    return STATUS_ERROR;
+  }
+  db->map = map;
+  db->map_len = new_off;
+  db->records = (dbrecord_t *)((char *)map + sizeof(dbheader_t));
+  db->capacity = capacity;
+  db->hdr->strings_offset = new_off;
+  db->hdr->filesize = new_off + synced;
+  return STATUS_SUCCESS;
+}
 
-  strncpy(employees[dbhdr->count - 1].name, name,
-          sizeof(employees[dbhdr->count - 1].name));
-  employees[dbhdr->count - 1]
-      .name[sizeof(employees[dbhdr->count - 1].name) - 1] = '\0';
+static int reserve_records(database_t *db, size_t capacity) {
+  if (capacity <= db->capacity) {
+    return STATUS_SUCCESS;
+  }
 
-  strncpy(employees[dbhdr->count - 1].address, addr,
-          sizeof(employees[dbhdr->count - 1].address));
-  employees[dbhdr->count - 1]
-      .address[sizeof(employees[dbhdr->count - 1].address) - 1] = '\0';
+  if (db->map != NULL) {
+    return remap_employees(db, capacity);
+  }
 
-  employees[dbhdr->count - 1].hours = (unsigned int)parsed_hours;
+  dbrecord_t *tmp = realloc(db->records, capacity * sizeof(dbrecord_t));
+  if (tmp == NULL) {
+    log_error("Failed to reallocate memory for employees: %m");
+    return STATUS_ERROR;
+  }
+  db->records = tmp;
+  db->capacity = capacity;
+  return STATUS_SUCCESS;
+}
 
-  free(input_copy);
+int reserve_employees(database_t *db, size_t capacity) {
+  if (reserve_records(db, capacity) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  if (db->columns != NULL) {
+    return columns_reserve(db->columns, db->capacity);
+  }
   return STATUS_SUCCESS;
 }
 
-int update_working_hours(dbheader_t *dbhdr, employee_t *employees,
-                         char *updatestring) {
+int build_columns(database_t *db) {
+  dbcolumns_t *cols = calloc(1, sizeof(dbcolumns_t));
+  if (cols == NULL) {
+    log_error("Failed to allocate columnar mirror: %m");
+    return STATUS_ERROR;
+  }
+  if (columns_reserve(cols, db->capacity ? db->capacity : 1) !=
+      STATUS_SUCCESS) {
+    free(cols);
+    return STATUS_ERROR;
+  }
 
-  char *input_copy = strdup(updatestring);
-  if (!input_copy) {
-    perror("Failed to duplicate updatestring");
+  for (uint64_t i = 0; i < db->hdr->count; i++) {
+    cols->hours[i] = db->records[i].hours;
+  }
+  db->columns = cols;
+  return STATUS_SUCCESS;
+}
+
+static void shrink_employees(database_t *db) {
+  size_t count = db->hdr->count;
+  if (db->map != NULL || db->capacity <= EMPLOYEES_MIN_CAPACITY || count > db->capacity / 4) {
+    return;
+  }
+
+  size_t capacity = db->capacity / 2;
+  dbrecord_t *tmp = realloc(db->records, capacity * sizeof(dbrecord_t));
+  if (tmp != NULL) {
+    db->records = tmp;
+    db->capacity = capacity;
+  }
+}
+
+int grow_employees(database_t *db, size_t count) {
+  size_t capacity = db->capacity;
+
+  if (count > capacity) {
+    capacity = capacity ? capacity * 2 : EMPLOYEES_MIN_CAPACITY;
+    while (capacity < count) {
+      capacity *= 2;
+    }
+  }
+  return reserve_employees(db, capacity);
+}
+
+int insert_employee(database_t *db, const employee_t *employee) {
+  dbheader_t *dbhdr = db->hdr;
+  dbrecord_t rec;
+
+  if (dbhdr->count >= NAMEINDEX_EMPTY) {
+    log_error("Database is full (%lu records).", dbhdr->count);
     return STATUS_ERROR;
   }
 
-  char *name = strtok(input_copy, ",");
-  char *hours_str = strtok(NULL, ",");
+  if (grow_employees(db, dbhdr->count + 1) != STATUS_SUCCESS ||
+      hoursindex_reserve(&db->hours) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
 
-  if (name == NULL || hours_str == NULL) {
-    fprintf(
-        stderr,
-        "Error: Invalid format for update string. Expected 'name, hours'.\n");
-    free(input_copy);
+  if (make_record(db, employee->name,
+                  strnlen(employee->name, RECORD_STRING_MAX),
+                  employee->address,
+                  strnlen(employee->address, RECORD_STRING_MAX),
+                  employee->hours, &rec) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
 
-  unsigned int parsed_hours;
-  if (parse_and_validate_hours(hours_str, &parsed_hours) != STATUS_SUCCESS) {
-    free(input_copy);
+  db->records[dbhdr->count] = rec;
+  if (db->columns != NULL) {
+    db->columns->hours[dbhdr->count] = rec.hours;
+  }
+  if (nameindex_insert(&db->index, db, dbhdr->count) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+  if (db->wal != NULL &&
+      wal_log_add(db->wal, dbhdr->count, db, &rec) != STATUS_SUCCESS) {
+    nameindex_remove(&db->index, db, dbhdr->count);
+    return STATUS_ERROR;
+  }
+  hoursindex_insert(&db->hours, rec.hours, dbhdr->count);
+  dbhdr->count++;
+  return STATUS_SUCCESS;
+}
+
+int add_employee(database_t *db, char *addstring) {
+  employee_t employee;
+
+  if (parse_employee(addstring, &employee) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
 
-  int index = find_employee_index(dbhdr, employees, name);
+  return insert_employee(db, &employee);
+}
+
+/* The kernel may write back mapped pages at any time, so a change to a row
+   the file header counts must not reach the file before its log record
+   does. Rows past that count are ignored after a crash until replay
+   rewrites them, so changes there need no commit. */
+static int commit_before_mapping(database_t *db, uint64_t row) {
+  if (db->map == NULL || row >= db->records_synced) {
+    return STATUS_SUCCESS;
+  }
+  return wal_commit(db->wal);
+}
+
+int set_employee_hours(database_t *db, const char *name, unsigned int hours) {
+  long index = find_employee_index(db, name);
 
   if (index == -1) {
-    fprintf(stderr, "Error: Employee '%s' not found.\n", name);
-    free(input_copy);
+    log_debug("Employee '%s' not found.", name);
+    return STATUS_ERROR;
+  }
+
+  if (hoursindex_reserve(&db->hours) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
 
-  employees[index].hours = (unsigned int)parsed_hours;
+  if (db->wal != NULL &&
+      (wal_log_update(db->wal, index, hours) != STATUS_SUCCESS ||
+       commit_before_mapping(db, index) != STATUS_SUCCESS)) {
+    return STATUS_ERROR;
+  }
 
-  free(input_copy);
+  hoursindex_remove(&db->hours, db->records[index].hours, index);
+  hoursindex_insert(&db->hours, hours, index);
+  db->records[index].hours = hours;
+  if (db->columns != NULL) {
+    db->columns->hours[index] = hours;
+  }
   return STATUS_SUCCESS;
 }
 
-int delete_employee(dbheader_t *dbhdr, employee_t **employees_ptr,
-                    char *username) {
-  if (dbhdr->count == 0 || *employees_ptr == NULL) {
-    fprintf(stderr, "Error: Database is empty, cannot delete.\n");
+int update_working_hours(database_t *db, char *updatestring) {
+  span_t input = {updatestring, strlen(updatestring)};
+  span_t name;
+  unsigned int hours;
+  char name_buf[sizeof(((employee_t *)0)->name)];
+
+  if (parse_update_span(input, &name, &hours) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
 
-  employee_t *employees = *employees_ptr;
+  if (name.len >= sizeof(name_buf)) {
+    log_debug("Employee '%.*s' not found.", (int)name.len, name.ptr);
+    return STATUS_ERROR;
+  }
+  memcpy(name_buf, name.ptr, name.len);
+  name_buf[name.len] = '\0';
+
+  return set_employee_hours(db, name_buf, hours);
+}
+
+int delete_employee(database_t *db, const char *username) {
+  dbheader_t *dbhdr = db->hdr;
 
-  int index = find_employee_index(dbhdr, employees, username);
+  if (dbhdr->count == 0 || db->records == NULL) {
+    log_error("Database is empty, cannot delete.");
+    return STATUS_ERROR;
+  }
+
+  long index = find_employee_index(db, username);
 
   if (index == -1) {
-    fprintf(stderr, "Error: Employee '%s' not found.\n", username);
+    log_debug("Employee '%s' not found.", username);
     return STATUS_ERROR;
   }
 
-  if (index < dbhdr->count - 1) {
-    memmove(&(*employees_ptr)[index], &(*employees_ptr)[index + 1],
-            ((dbhdr->count - index - 1) * sizeof(employee_t)));
+  if (hoursindex_reserve(&db->hours) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  long last = dbhdr->count - 1;
+  if (db->wal != NULL) {
+    const dbrecord_t *moved = index != last ? &db->records[last] : NULL;
+    if (wal_log_delete(db->wal, index, last, db, moved) != STATUS_SUCCESS ||
+        commit_before_mapping(db, index) != STATUS_SUCCESS) {
+      return STATUS_ERROR;
+    }
+  }
+
+  nameindex_remove(&db->index, db, index);
+  hoursindex_remove(&db->hours, db->records[index].hours, index);
+
+  /* Interned strings may be shared, so this only bounds the garbage. */
+  db->strings.dead +=
+      db->records[index].name_len + db->records[index].address_len + 2;
+
+  if (index != last) {
+    db->records[index] = db->records[last];
+    if (db->columns != NULL) {
+      db->columns->hours[index] = db->columns->hours[last];
+    }
+    nameindex_renumber(&db->index, record_name(db, &db->records[index]), last,
+                       index);
+    hoursindex_remove(&db->hours, db->records[index].hours, last);
+    hoursindex_insert(&db->hours, db->records[index].hours, index);
   }
 
   dbhdr->count--;
+  shrink_employees(db);
 
-  if (dbhdr->count > 0) {
-    employee_t *tmp =
-        realloc(*employees_ptr, dbhdr->count * sizeof(employee_t));
+  return STATUS_SUCCESS;
+}
 
-    if (tmp == NULL) {
-      perror("Failed to reallocate memory after deletion");
-      dbhdr->count++;
-      return STATUS_ERROR;
+/* After a crash in mapped mode, rows may point at strings that were never
+   synced; the log replay that follows rewrites them. */
+static void check_records(database_t *db) {
+  size_t cleared = 0;
+  for (uint64_t i = 0; i < db->hdr->count; i++) {
+    dbrecord_t *rec = &db->records[i];
+    if (!strarena_valid(&db->strings, rec->name_off, rec->name_len) ||
+        !strarena_valid(&db->strings, rec->address_off, rec->address_len)) {
+      rec->name_off = rec->address_off = 0;
+      rec->name_len = rec->address_len = 0;
+      cleared++;
     }
-    *employees_ptr = tmp;
-  } else {
-    free(*employees_ptr);
-    *employees_ptr = NULL;
   }
+  if (cleared > 0) {
+    log_warn("Cleared %zu record(s) pointing outside the string arena",
+             cleared);
+  }
+}
 
+static int read_strings(database_t *db) {
+  size_t size = db->hdr->strings_size;
+  char *data = malloc(size ? size : 1);
+  if (data == NULL) {
+    log_error("Failed to allocate string arena: %m");
+    return STATUS_ERROR;
+  }
+
+  if (pread_full(db->fd, data, size, db->hdr->strings_offset) !=
+      STATUS_SUCCESS) {
+    log_error("Incomplete read for string arena. Expected %zu bytes", size);
+    free(data);
+    return STATUS_ERROR;
+  }
+
+  if (strarena_adopt(&db->strings, data, size) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+  db->strings_synced = size;
   return STATUS_SUCCESS;
 }
 
-int read_employees(int fd, dbheader_t *dbhdr, employee_t **employeesOut) {
-  if (fd < 0) {
-    printf("Got a bad FD from the user\n");
+static int compact_strings(database_t *db) {
+  size_t count = db->hdr->count;
+  strarena_t fresh = {0};
+  uint32_t *offsets = malloc((count ? count : 1) * 2 * sizeof(uint32_t));
+
+  if (offsets == NULL || strarena_reset(&fresh) != STATUS_SUCCESS) {
+    log_error("Failed to allocate string arena for compaction: %m");
+    free(offsets);
     return STATUS_ERROR;
   }
 
-  int count = dbhdr->count;
+  for (size_t i = 0; i < count; i++) {
+    const dbrecord_t *rec = &db->records[i];
+    if (strarena_intern(&fresh, record_name(db, rec), rec->name_len,
+                        &offsets[2 * i]) != STATUS_SUCCESS ||
+        strarena_intern(&fresh, record_address(db, rec), rec->address_len,
+                        &offsets[2 * i + 1]) != STATUS_SUCCESS) {
+      strarena_free(&fresh);
+      free(offsets);
+      return STATUS_ERROR;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    db->records[i].name_off = offsets[2 * i];
+    db->records[i].address_off = offsets[2 * i + 1];
+  }
+  free(offsets);
+
+  log_info("Compacted string arena from %zu to %zu bytes", db->strings.len,
+           fresh.len);
+  strarena_free(&db->strings);
+  db->strings = fresh;
+  return STATUS_SUCCESS;
+}
 
-  if (count == 0) {
-    *employeesOut = NULL;
+/* Drops unreferenced strings once deletes have left the arena half
+   garbage. */
+int compact_strings_if_needed(database_t *db) {
+  if (db->strings.dead * 2 <= db->strings.len) {
     return STATUS_SUCCESS;
   }
+  if (compact_strings(db) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+  db->strings.dead = 0;
+  return STATUS_SUCCESS;
+}
+
+static int map_employees(database_t *db) {
+  dbheader_t *dbhdr = db->hdr;
+  size_t map_len = dbhdr->strings_offset;
 
-  employee_t *employees = calloc(count, sizeof(employee_t));
-  if (employees == NULL) {
-    perror("Failed to allocate memory for employees");
+  void *map =
+      mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, db->fd, 0);
+  if (map == MAP_FAILED) {
+    log_error("Failed to map database file: %m");
     return STATUS_ERROR;
   }
 
-  ssize_t bytes_read = read(fd, employees, count * sizeof(employee_t));
+  db->map = map;
+  db->map_len = map_len;
+  db->records = (dbrecord_t *)((char *)map + sizeof(dbheader_t));
+  db->capacity = (map_len - sizeof(dbheader_t)) / sizeof(dbrecord_t);
+  db->records_synced = dbhdr->count;
 
-  if (bytes_read == -1) {
-    perror("Failed to read employees from file");
-    free(employees);
+  if (!(dbhdr->flags & HEADER_FLAG_NATIVE)) {
+    log_info("Converting database records to native byte order");
+    for (uint64_t i = 0; i < dbhdr->count; i++) {
+      record_from_be(&db->records[i]);
+    }
+    dbhdr->flags |= HEADER_FLAG_NATIVE;
+    if (sync_mapped_file(db) != STATUS_SUCCESS) {
+      return STATUS_ERROR;
+    }
+  }
+
+  if (reserve_employees(db, EMPLOYEES_MIN_CAPACITY) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
-  if (bytes_read != count * sizeof(employee_t)) {
-    fprintf(stderr,
-            "Error: Incomplete read for employees. Expected %zu, got %zd\n",
-            count * sizeof(employee_t), bytes_read);
-    free(employees);
+
+  check_records(db);
+  return nameindex_build(&db->index, db, dbhdr->count);
+}
+
+/* Mapped mode keeps the arena in memory and appends whatever was interned
+   since the last sync behind the strings already on disk. */
+int sync_mapped_file(database_t *db) {
+  dbheader_t *dbhdr = db->hdr;
+  size_t used = sizeof(dbheader_t) + (size_t)dbhdr->count * sizeof(dbrecord_t);
+  size_t synced = db->strings_synced;
+
+  if (msync(db->map, used, MS_SYNC) == -1) {
+    log_error("Failed to msync database file: %m");
     return STATUS_ERROR;
   }
 
-  for (int i = 0; i < count; i++) {
-    employees[i].hours = ntohl(employees[i].hours);
+  if (pwrite_full(db->fd, db->strings.data + synced,
+                  db->strings.len - synced,
+                  dbhdr->strings_offset + synced) != STATUS_SUCCESS ||
+      fdatasync(db->fd) == -1) {
+    log_error("Failed to write string arena: %m");
+    return STATUS_ERROR;
+  }
+
+  dbhdr->strings_size = db->strings.len;
+  dbhdr->filesize = dbhdr->strings_offset + dbhdr->strings_size;
+  dbheader_t header_to_write;
+  encode_db_header(dbhdr, &header_to_write);
+
+  if (pwrite_full(db->fd, &header_to_write, sizeof(header_to_write), 0) !=
+      STATUS_SUCCESS) {
+    log_error("Failed to write header: %m");
+    return STATUS_ERROR;
   }
 
-  *employeesOut = employees;
+  db->strings_synced = db->strings.len;
+  db->records_synced = dbhdr->count;
   return STATUS_SUCCESS;
 }
 
-int output_file(int fd, dbheader_t *dbhdr, employee_t *employees) {
+void unmap_employees(database_t *db) {
+  if (db->map == NULL) {
+    return;
+  }
+
+  munmap(db->map, db->map_len);
+  db->map = NULL;
+  db->map_len = 0;
+  db->records = NULL;
+  db->capacity = 0;
+}
+
+int read_employees(database_t *db) {
+  int fd = db->fd;
   if (fd < 0) {
-    fprintf(stderr, "Got a bad FD from the user\n");
+    log_error("Got a bad FD from the user");
     return STATUS_ERROR;
   }
 
-  int realcount = dbhdr->count;
-
-  off_t final_filesize =
-      sizeof(dbheader_t) + ((off_t)realcount * sizeof(employee_t));
+  if (read_strings(db) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
 
-  dbheader_t header_to_write = *dbhdr;
+  if (db->mapped) {
+    return map_employees(db);
+  }
 
-  header_to_write.magic = htonl(dbhdr->magic);
-  header_to_write.filesize = htonl((u_int32_t)final_filesize);
-  header_to_write.count = htons(dbhdr->count);
-  header_to_write.version = htons(dbhdr->version);
+  size_t count = db->hdr->count;
 
-  if (lseek(fd, 0, SEEK_SET) == -1) {
-    perror("Failed to seek to beginning of file");
+  if (reserve_employees(db, count) != STATUS_SUCCESS) {
     return STATUS_ERROR;
-  };
+  }
 
-  ssize_t bytes_written = write(fd, &header_to_write, sizeof(dbheader_t));
-  if (bytes_written == STATUS_ERROR) {
-    perror("Failed to write header");
+  if (count > 0 && pread_full(fd, db->records, count * sizeof(dbrecord_t),
+                              sizeof(dbheader_t)) != STATUS_SUCCESS) {
+    log_error("Incomplete read for employees. Expected %zu bytes",
+              count * sizeof(dbrecord_t));
     return STATUS_ERROR;
   }
 
-  if (bytes_written != sizeof(dbheader_t)) {
-    fprintf(stderr,
-            "Error: Incomplete write for header. Expected %zu, wrote %zd\n",
-            sizeof(dbheader_t), bytes_written);
-    return STATUS_ERROR;
+  if (!(db->hdr->flags & HEADER_FLAG_NATIVE)) {
+    for (size_t i = 0; i < count; i++) {
+      record_from_be(&db->records[i]);
+    }
   }
 
-  for (int i = 0; i < realcount; i++) {
-    uint32_t original_hours = employees[i].hours;
-    uint32_t network_hours = htonl(original_hours);
+  check_records(db);
+  return nameindex_build(&db->index, db, count);
+}
 
-    employees[i].hours = network_hours;
+/* Writes iov in full at offset, picking up after short writes. */
+static int pwritev_full(int fd, struct iovec *iov, int iovcnt, off_t offset) {
+  while (iovcnt > 0) {
+    ssize_t n = pwritev(fd, iov, iovcnt, offset);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return STATUS_ERROR;
+    offset += n;
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return STATUS_SUCCESS;
+}
 
-    bytes_written = write(fd, &employees[i], sizeof(employee_t));
+/* Encodes the header and records into a staging buffer and writes the whole
+   snapshot to a temporary file, the string arena riding along in the last
+   pwritev. The file replaces the original only once it is on disk. */
+static int write_snapshot(database_t *db, int fd) {
+  uint64_t realcount = db->hdr->count;
+  size_t total = sizeof(dbheader_t) + realcount * sizeof(dbrecord_t);
+  size_t staging_len = total < SNAPSHOT_STAGING ? total : SNAPSHOT_STAGING;
+  unsigned char *staging = malloc(staging_len);
+  if (staging == NULL) {
+    log_error("Failed to allocate snapshot buffer: %m");
+    return STATUS_ERROR;
+  }
 
-    employees[i].hours = original_hours;
+  encode_db_header(db->hdr, (dbheader_t *)staging);
+  size_t used = sizeof(dbheader_t);
+  off_t offset = 0;
+  uint64_t i = 0;
 
-    if (bytes_written == -1) {
-      char error_msg[100];
-      snprintf(error_msg, sizeof(error_msg),
-               "Failed to write employee %d to file", i);
-      perror(error_msg);
-      return STATUS_ERROR;
+  while (1) {
+    size_t n = (staging_len - used) / sizeof(dbrecord_t);
+    if (n > realcount - i) {
+      n = realcount - i;
     }
-    if (bytes_written != sizeof(employee_t)) {
-      fprintf(
-          stderr,
-          "Error: Incomplete write for employee %d. Expected %zu, wrote %zd\n",
-          i, sizeof(employee_t), bytes_written);
+    dbrecord_t *out = (dbrecord_t *)(staging + used);
+    for (size_t j = 0; j < n; j++) {
+      record_to_be(&db->records[i + j], &out[j]);
+    }
+    used += n * sizeof(dbrecord_t);
+    i += n;
+    if (i == realcount) {
+      break;
+    }
+    if (pwrite_full(fd, staging, used, offset) != STATUS_SUCCESS) {
+      log_error("Failed to write employees to snapshot: %m");
+      free(staging);
       return STATUS_ERROR;
     }
+    offset += used;
+    used = 0;
+  }
+
+  struct iovec iov[2] = {
+      {.iov_base = staging, .iov_len = used},
+      {.iov_base = db->strings.data, .iov_len = db->strings.len},
+  };
+  int ret = pwritev_full(fd, iov, 2, offset);
+  if (ret != STATUS_SUCCESS) {
+    log_error("Failed to write snapshot: %m");
+  }
+  free(staging);
+  return ret;
+}
+
+int output_file(database_t *db) {
+  dbheader_t *dbhdr = db->hdr;
+  if (db->fd < 0 || db->path == NULL) {
+    log_error("Got a bad FD from the user");
+    return STATUS_ERROR;
   }
 
-  if (ftruncate(fd, final_filesize) == -1) {
-    perror("Failed to ftruncate file to final size");
+  if (compact_strings_if_needed(db) != STATUS_SUCCESS) {
     return STATUS_ERROR;
   }
 
-  header_to_write.magic = ntohl(dbhdr->magic);
-  header_to_write.filesize = ntohl((u_int32_t)final_filesize);
-  header_to_write.count = ntohs(dbhdr->count);
-  header_to_write.version = ntohs(dbhdr->version);
+  uint64_t realcount = dbhdr->count;
 
+  dbhdr->version = HEADER_VERSION;
+  dbhdr->flags &= ~HEADER_FLAG_NATIVE;
+  dbhdr->strings_offset =
+      sizeof(dbheader_t) + realcount * sizeof(dbrecord_t);
+  dbhdr->strings_size = db->strings.len;
+  dbhdr->filesize = dbhdr->strings_offset + dbhdr->strings_size;
+  dbhdr->record_size = sizeof(dbrecord_t);
+
+  char *tmp_path = NULL;
+  int fd = create_temp_file(db->path, &tmp_path);
+  if (fd == STATUS_ERROR) {
+    return STATUS_ERROR;
+  }
+
+  if (write_snapshot(db, fd) != STATUS_SUCCESS || fsync(fd) == -1 ||
+      replace_file(tmp_path, db->path) != STATUS_SUCCESS) {
+    log_error("Failed to save snapshot to %s: %m", tmp_path);
+    close(fd);
+    unlink(tmp_path);
+    free(tmp_path);
+    return STATUS_ERROR;
+  }
+  free(tmp_path);
+
+  close(db->fd);
+  db->fd = fd;
+  db->strings.dead = 0;
+  db->strings_synced = db->strings.len;
   return STATUS_SUCCESS;
 }
 
+static int read_v1_header(int fd, dbheader_t *header) {
+  dbheader_v1_t v1;
+  if (pread(fd, &v1, sizeof(v1), 0) != sizeof(v1)) {
+    log_error("Incomplete read for version 1 header");
+    return STATUS_ERROR;
+  }
+
+  uint16_t version = ntohs(v1.version);
+  header->magic = ntohl(v1.magic);
+  header->version = 1;
+  header->flags = (version & HEADER_V1_FLAG_NATIVE) ? HEADER_FLAG_NATIVE : 0;
+  header->count = ntohs(v1.count);
+  header->filesize = ntohl(v1.filesize);
+  header->record_size = sizeof(employee_t);
+  header->checksum = 0;
+  return STATUS_SUCCESS;
+}
+
+static int read_v2_header(int fd, dbheader_t *header) {
+  dbheader_v2_t v2;
+  if (pread(fd, &v2, sizeof(v2), 0) != sizeof(v2)) {
+    log_error("Incomplete read for version 2 header");
+    return STATUS_ERROR;
+  }
+
+  uint32_t stored_checksum = ntohl(v2.checksum);
+  v2.checksum = 0;
+  if (crc32_update(0, &v2, sizeof(v2)) != stored_checksum) {
+    log_error("Corrupted database. Header checksum mismatch.");
+    return STATUS_ERROR;
+  }
+
+  header->magic = ntohl(v2.magic);
+  header->version = ntohs(v2.version);
+  header->flags = ntohs(v2.flags);
+  header->count = be64toh(v2.count);
+  header->filesize = be64toh(v2.filesize);
+  header->record_size = ntohl(v2.record_size);
+  header->checksum = stored_checksum;
+
+  if (header->record_size != sizeof(employee_t)) {
+    log_error("Unsupported record size. Expected %zu, got %u",
+              sizeof(employee_t), header->record_size);
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+static int read_v3_header(int fd, dbheader_t *header) {
+  if (pread(fd, header, sizeof(dbheader_t), 0) != sizeof(dbheader_t)) {
+    log_error("Incomplete read for version %d header", HEADER_VERSION);
+    return STATUS_ERROR;
+  }
+
+  if (decode_db_header(header) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  if (header->record_size != sizeof(dbrecord_t)) {
+    log_error("Unsupported record size. Expected %zu, got %u",
+              sizeof(dbrecord_t), header->record_size);
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+static size_t legacy_header_size(const dbheader_t *header) {
+  return header->version == 1 ? sizeof(dbheader_v1_t) : sizeof(dbheader_v2_t);
+}
+
+static bool valid_layout(const dbheader_t *header) {
+  if (header->version != HEADER_VERSION) {
+    return header->count <= header->filesize / sizeof(employee_t) &&
+           header->filesize == legacy_header_size(header) +
+                                   header->count * sizeof(employee_t);
+  }
+
+  uint64_t records_end =
+      sizeof(dbheader_t) + header->count * sizeof(dbrecord_t);
+  return header->count <= header->filesize / sizeof(dbrecord_t) &&
+         header->strings_offset >= records_end &&
+         (header->strings_offset - sizeof(dbheader_t)) % sizeof(dbrecord_t) ==
+             0 &&
+         header->strings_size <= header->filesize &&
+         header->filesize == header->strings_offset + header->strings_size;
+}
+
 int validate_db_header(int fd, dbheader_t **headerOut) {
   if (fd < 0) {
-    printf("Got a bad FD from the user\n");
+    log_error("Got a bad FD from the user");
     return STATUS_ERROR;
   }
 
   dbheader_t *header = calloc(1, sizeof(dbheader_t));
   if (header == NULL) {
-    perror("Malloc failed create a db header\n");
+    log_error("Malloc failed create a db header: %m");
     return STATUS_ERROR;
   }
 
-  ssize_t bytes_read = read(fd, header, sizeof(dbheader_t));
+  struct {
+    uint32_t magic;
+    uint16_t version;
+  } prefix;
+  ssize_t bytes_read = pread(fd, &prefix, sizeof(prefix), 0);
   if (bytes_read == STATUS_ERROR) {
-    perror("Failed to read header from file");
+    log_error("Failed to read header from file: %m");
     free(header);
     return STATUS_ERROR;
   }
-  if (bytes_read != sizeof(dbheader_t)) {
-    fprintf(stderr,
-            "Error: Incomplete read for header. Expected %zu, got %zd\n",
-            sizeof(dbheader_t), bytes_read);
+  if (bytes_read != sizeof(prefix)) {
+    log_error("Incomplete read for header. Expected %zu, got %zd",
+              sizeof(prefix), bytes_read);
     free(header);
     return STATUS_ERROR;
   }
 
-  header->version = ntohs(header->version);
-  header->count = ntohs(header->count);
-  header->magic = ntohl(header->magic);
-  header->filesize = ntohl(header->filesize);
-
-  if (header->magic != HEADER_MAGIC) {
-    fprintf(stderr, "Error: Invalid magic number. Expected 0x%X, got 0x%X\n",
-            HEADER_MAGIC, header->magic);
+  if (ntohl(prefix.magic) != HEADER_MAGIC) {
+    log_error("Invalid magic number. Expected 0x%X, got 0x%X", HEADER_MAGIC,
+              ntohl(prefix.magic));
     free(header);
     return STATUS_ERROR;
   }
 
-  if (header->version != 1) {
-    fprintf(stderr, "Error: Unsupported database version. Expected 1, got %d\n",
-            header->version);
+  uint16_t version = ntohs(prefix.version);
+  int ret;
+  if ((version & ~HEADER_V1_FLAG_NATIVE) == 1) {
+    ret = read_v1_header(fd, header);
+  } else if (version == 2) {
+    ret = read_v2_header(fd, header);
+  } else if (version == HEADER_VERSION) {
+    ret = read_v3_header(fd, header);
+  } else {
+    log_error("Unsupported database version. Expected 1 to %d, got %d",
+              HEADER_VERSION, version);
+    ret = STATUS_ERROR;
+  }
+  if (ret != STATUS_SUCCESS) {
     free(header);
     return STATUS_ERROR;
   }
 
   struct stat dbstat = {0};
   if (fstat(fd, &dbstat) == -1) {
-    perror("Failed to get file status");
+    log_error("Failed to get file status: %m");
     free(header);
     return STATUS_ERROR;
   };
 
-  if (header->filesize != dbstat.st_size) {
-    fprintf(stderr,
-            "Error: Corrupted database. Header filesize (%u) does not match "
-            "actual file size (%ld).\n",
-            header->filesize, dbstat.st_size);
+  /* Mapped files may carry space past the recorded size. */
+  if (!valid_layout(header) ||
+      (header->filesize != (uint64_t)dbstat.st_size &&
+       !((header->flags & HEADER_FLAG_NATIVE) &&
+         header->filesize < (uint64_t)dbstat.st_size))) {
+    log_error("Corrupted database. Header filesize (%lu) does not match "
+              "actual file size (%ld).", header->filesize, dbstat.st_size);
     free(header);
     return STATUS_ERROR;
   }
@@ -386,17 +1037,81 @@ int validate_db_header(int fd, dbheader_t **headerOut) {
   return STATUS_SUCCESS;
 }
 
+int upgrade_db_file(database_t *db) {
+  dbheader_t *dbhdr = db->hdr;
+  if (dbhdr->version == HEADER_VERSION) {
+    return STATUS_SUCCESS;
+  }
+
+  log_info("Upgrading database file from version %d to %d", dbhdr->version,
+           HEADER_VERSION);
+
+  if (reserve_employees(db, dbhdr->count) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  size_t header_size = legacy_header_size(dbhdr);
+  employee_t *chunk = malloc(RECORD_CHUNK * sizeof(employee_t));
+  if (chunk == NULL) {
+    log_error("Failed to allocate memory for upgrade: %m");
+    return STATUS_ERROR;
+  }
+
+  int ret = STATUS_SUCCESS;
+  for (uint64_t i = 0; i < dbhdr->count && ret == STATUS_SUCCESS;
+       i += RECORD_CHUNK) {
+    size_t n = dbhdr->count - i < RECORD_CHUNK ? dbhdr->count - i
+                                               : RECORD_CHUNK;
+    if (pread_full(db->fd, chunk, n * sizeof(employee_t),
+                   header_size + i * sizeof(employee_t)) != STATUS_SUCCESS) {
+      log_error("Incomplete read for employees during upgrade");
+      ret = STATUS_ERROR;
+      break;
+    }
+    for (size_t j = 0; j < n && ret == STATUS_SUCCESS; j++) {
+      const employee_t *employee = &chunk[j];
+      unsigned int hours = (dbhdr->flags & HEADER_FLAG_NATIVE)
+                               ? employee->hours
+                               : ntohl(employee->hours);
+      ret = make_record(db, employee->name,
+                        strnlen(employee->name, RECORD_STRING_MAX),
+                        employee->address,
+                        strnlen(employee->address, RECORD_STRING_MAX),
+                        hours, &db->records[i + j]);
+    }
+  }
+  free(chunk);
+
+  if (ret == STATUS_SUCCESS) {
+    ret = output_file(db);
+  }
+
+  free(db->records);
+  db->records = NULL;
+  db->capacity = 0;
+
+  if (ret != STATUS_SUCCESS || fsync(db->fd) == -1) {
+    log_error("Failed to write upgraded database file");
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
 int create_db_header(int fd, dbheader_t **headerOut) {
   dbheader_t *header = calloc(1, sizeof(dbheader_t));
   if (header == NULL) {
-    perror("Malloc failed to create db header");
+    log_error("Malloc failed to create db header: %m");
     return STATUS_ERROR;
   }
 
-  header->version = 0x1;
+  header->version = HEADER_VERSION;
+  header->flags = 0;
   header->count = 0;
   header->magic = HEADER_MAGIC;
-  header->filesize = sizeof(dbheader_t);
+  header->strings_offset = sizeof(dbheader_t);
+  header->strings_size = 1;
+  header->filesize = header->strings_offset + header->strings_size;
+  header->record_size = sizeof(dbrecord_t);
 
   *headerOut = header;
 
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "db.h"
+#include "file.h"
+#include "log.h"
+#include "metrics.h"
+#include "parse.h"
+#include "save.h"
+#include "wal.h"
+
+#define SAVE_POLICY_INTERVAL_S 1
+
+int parse_save_policy(const char *arg, savepolicy_t *out) {
+  char *end;
+
+  unsigned long seconds = strtoul(arg, &end, 10);
+  if (end == arg || *end != '/') {
+    return STATUS_ERROR;
+  }
+
+  const char *changes_arg = end + 1;
+  unsigned long long changes = strtoull(changes_arg, &end, 10);
+  if (end == changes_arg || *end != '\0' || changes == 0) {
+    return STATUS_ERROR;
+  }
+
+  out->seconds = seconds;
+  out->changes = changes;
+  return STATUS_SUCCESS;
+}
+
+static bool policy_due(saver_t *saver) {
+  return saver->policy.changes > 0 &&
+         wal_changes(saver->db->wal) >= saver->policy.changes &&
+         metrics_now() - saver->last_save >=
+             saver->policy.seconds * 1000000000ull;
+}
+
+static void close_fds(unsigned first, unsigned last) {
+  if (first > last || close_range(first, last, 0) == 0) {
+    return;
+  }
+  long max = sysconf(_SC_OPEN_MAX);
+  for (long fd = first; fd < max && fd <= (long)last; fd++) {
+    close(fd);
+  }
+}
+
+/* The child's copy of memory is the snapshot; output_file() writes it to a
+   temporary file and renames it over the database. It dies with the saver
+   thread so a restarted server never races an orphaned writer, and keeps
+   only the database file and stdio, so clients the parent closes see the
+   connection end at once. */
+static void write_child_snapshot(database_t *db, unsigned epoch,
+                                 pid_t parent) {
+  log_detach();
+  if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1 || getppid() != parent) {
+    _exit(EXIT_FAILURE);
+  }
+  close_fds(STDERR_FILENO + 1, db->fd - 1);
+  close_fds(db->fd + 1, ~0U);
+  set_header_epoch(db->hdr, epoch);
+  _exit(output_file(db) == STATUS_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static int finish_save(database_t *db, unsigned epoch) {
+  int fd = open_db_file(db->path);
+  if (fd == STATUS_ERROR) {
+    return STATUS_ERROR;
+  }
+
+  close(db->fd);
+  db->fd = fd;
+  set_header_epoch(db->hdr, epoch);
+  return wal_drop_rotated(db->wal);
+}
+
+/* Writes are paused only while the log is rotated and the process forked;
+   the child writes the snapshot while the reactors carry on. */
+static int save_in_background(database_t *db) {
+  pthread_rwlock_wrlock(&db->lock);
+
+  /* Shared mappings are not copied on fork, and a segment left behind by a
+     failed save needs a full checkpoint to fold it in. */
+  if (db->map != NULL || db->wal->rotated) {
+    pthread_rwlock_unlock(&db->lock);
+    return db_checkpoint(db);
+  }
+
+  /* Compacted here, or only the child's copy would ever shrink. */
+  uint64_t start = metrics_now();
+  if (compact_strings_if_needed(db) != STATUS_SUCCESS) {
+    pthread_rwlock_unlock(&db->lock);
+    log_error("Background save failed to compact the string arena");
+    return STATUS_ERROR;
+  }
+  if (wal_rotate(db->wal) != STATUS_SUCCESS) {
+    pthread_rwlock_unlock(&db->lock);
+    log_error("Background save failed to rotate the write-ahead log");
+    return STATUS_ERROR;
+  }
+
+  unsigned epoch = db->wal->epoch;
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (pid == 0) {
+    write_child_snapshot(db, epoch, parent);
+  }
+  uint64_t paused = metrics_now() - start;
+  pthread_rwlock_unlock(&db->lock);
+  metrics_phase(METRIC_SAVE_PAUSE, paused);
+
+  if (pid == -1) {
+    log_error("Background save failed to fork: %m");
+    return STATUS_ERROR;
+  }
+  log_info("Background save started in process %d, writes paused %.1f ms",
+           pid, paused / 1e6);
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      log_error("waitpid: %m");
+      return STATUS_ERROR;
+    }
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    log_error("Background save failed, keeping write-ahead log");
+    return STATUS_ERROR;
+  }
+
+  pthread_rwlock_wrlock(&db->lock);
+  int ret = finish_save(db, epoch);
+  pthread_rwlock_unlock(&db->lock);
+
+  if (ret == STATUS_SUCCESS) {
+    uint64_t elapsed = metrics_now() - start;
+    metrics_phase(METRIC_SAVE, elapsed);
+    log_info("Background save finished in %.1f ms", elapsed / 1e6);
+  }
+  return ret;
+}
+
+static void *saver_main(void *arg) {
+  saver_t *saver = arg;
+  metrics_attach_saver();
+
+  pthread_mutex_lock(&saver->lock);
+  while (!saver->stopping) {
+    if (!saver->requested && !policy_due(saver)) {
+      if (saver->policy.changes == 0) {
+        pthread_cond_wait(&saver->cond, &saver->lock);
+      } else {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SAVE_POLICY_INTERVAL_S;
+        pthread_cond_timedwait(&saver->cond, &saver->lock, &deadline);
+      }
+      continue;
+    }
+
+    saver->requested = false;
+    saver->saving = true;
+    pthread_mutex_unlock(&saver->lock);
+
+    save_in_background(saver->db);
+
+    pthread_mutex_lock(&saver->lock);
+    saver->saving = false;
+    saver->last_save = metrics_now();
+  }
+  pthread_mutex_unlock(&saver->lock);
+  return NULL;
+}
+
+int saver_start(database_t *db, const savepolicy_t *policy,
+                saver_t **saverOut) {
+  saver_t *saver = calloc(1, sizeof(saver_t));
+  if (saver == NULL) {
+    log_error("Failed to allocate saver: %m");
+    return STATUS_ERROR;
+  }
+
+  saver->db = db;
+  saver->policy = *policy;
+  saver->last_save = metrics_now();
+  pthread_mutex_init(&saver->lock, NULL);
+  pthread_cond_init(&saver->cond, NULL);
+
+  if (pthread_create(&saver->thread, NULL, saver_main, saver) != 0) {
+    log_error("pthread_create: %m");
+    pthread_mutex_destroy(&saver->lock);
+    pthread_cond_destroy(&saver->cond);
+    free(saver);
+    return STATUS_ERROR;
+  }
+
+  *saverOut = saver;
+  return STATUS_SUCCESS;
+}
+
+/* Returns false if a save was already queued or running. */
+bool saver_request(saver_t *saver) {
+  pthread_mutex_lock(&saver->lock);
+  bool queued = !saver->requested && !saver->saving;
+  saver->requested = true;
+  pthread_cond_signal(&saver->cond);
+  pthread_mutex_unlock(&saver->lock);
+  return queued;
+}
+
+/* Waits for a save in progress to finish. */
+void saver_stop(saver_t *saver) {
+  pthread_mutex_lock(&saver->lock);
+  saver->stopping = true;
+  pthread_cond_signal(&saver->cond);
+  pthread_mutex_unlock(&saver->lock);
+
+  pthread_join(saver->thread, NULL);
+  pthread_mutex_destroy(&saver->lock);
+  pthread_cond_destroy(&saver->cond);
+  free(saver);
+}
@@ -0,0 +1,48 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "search.h"
+
+/* Compares the needle's first and last byte against 16 candidate positions
+   at once and only runs memcmp where both match. */
+const char *find_substring(const char *hay, size_t hay_len, const char *needle,
+                           size_t needle_len) {
+  if (needle_len == 0) {
+    return hay;
+  }
+  if (needle_len > hay_len) {
+    return NULL;
+  }
+  if (needle_len == 1) {
+    return memchr(hay, needle[0], hay_len);
+  }
+
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+  for (; i + needle_len - 1 + 16 <= hay_len; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1));
+    unsigned int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+    while (mask != 0) {
+      unsigned int bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0) {
+        return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  return memmem(hay + i, hay_len - i, needle, needle_len);
+}
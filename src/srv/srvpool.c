@@ -1,33 +1,53 @@
+#include <endian.h>
+#include <errno.h>
 #include <netinet/in.h>
-#include <poll.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "common.h"
+#include "db.h"
+#include "log.h"
+#include "metrics.h"
+#include "search.h"
 #include "srvpoll.h"
+#include "stats.h"
 
-static int send_response(int fd, const void *data, size_t size) {
-  if (fd < 0) {
-    fprintf(stderr, "send_response: Invalid file descriptor\n");
+static int send_response(clientstate_t *client, const void *data,
+                         size_t size) {
+  if (client->fd < 0) {
+    log_error("send_response: Invalid file descriptor");
     return STATUS_ERROR;
   }
-  ssize_t bytes_written = write(fd, data, size);
 
-  if (bytes_written < 0) {
-    perror("send_response: write failed");
-    return STATUS_ERROR;
+  if (client->outbuf == NULL) {
+    client->outbuf = malloc(OUT_BUFF_SIZE);
+    if (client->outbuf == NULL) {
+      log_error("Failed to allocate client output buffer: %m");
+      return STATUS_ERROR;
+    }
   }
-  if ((size_t)bytes_written != size) {
-    fprintf(stderr,
-            "send_response: Incomplete write. Expected %zu, wrote %zd\n", size,
-            bytes_written);
+
+  if (OUT_BUFF_SIZE - client->out_len < size) {
+    log_error("send_response: Output buffer full. Queued %zu, adding %zu",
+              client->out_len, size);
     return STATUS_ERROR;
   }
+
+  size_t tail = (client->out_head + client->out_len) % OUT_BUFF_SIZE;
+  size_t first = OUT_BUFF_SIZE - tail;
+  if (first > size)
+    first = size;
+
+  memcpy(client->outbuf + tail, data, first);
+  memcpy(client->outbuf, (const unsigned char *)data + first, size - first);
+  client->out_len += size;
   return STATUS_SUCCESS;
 }
 
@@ -37,7 +57,7 @@ int fsm_prepare_and_send_hello_resp(clientstate_t *client,
   size_t response_size = sizeof(dbproto_hdr_t) + sizeof(dbproto_hello_resp);
 
   if (out_buffer_size < response_size) {
-    fprintf(stderr, "Output buffer too small for HELLO response.\n");
+    log_error("Output buffer too small for HELLO response.");
     return STATUS_ERROR;
   }
 
@@ -47,13 +67,13 @@ int fsm_prepare_and_send_hello_resp(clientstate_t *client,
 
   dbproto_hello_resp *payload =
       (dbproto_hello_resp *)(out_buffer + sizeof(dbproto_hdr_t));
-  payload->proto = PROTO_VER;
+  payload->proto = client->proto;
 
   hdr->type = htons(hdr->type);
   hdr->len = htons(hdr->len);
   payload->proto = htons(payload->proto);
 
-  return send_response(client->fd, out_buffer, response_size);
+  return send_response(client, out_buffer, response_size);
 }
 
 int fsm_prepare_and_send_add_resp(clientstate_t *client,
@@ -61,7 +81,7 @@ int fsm_prepare_and_send_add_resp(clientstate_t *client,
                                   size_t out_buffer_size) {
   size_t response_size = sizeof(dbproto_hdr_t);
   if (out_buffer_size < response_size) {
-    fprintf(stderr, "Output buffer too small for ADD response.\n");
+    log_error("Output buffer too small for ADD response.");
     return STATUS_ERROR;
   }
 
@@ -72,7 +92,7 @@ int fsm_prepare_and_send_add_resp(clientstate_t *client,
   hdr->type = htons(hdr->type);
   hdr->len = htons(hdr->len);
 
-  return send_response(client->fd, out_buffer, response_size);
+  return send_response(client, out_buffer, response_size);
 }
 
 int fsm_prepare_and_send_error_resp(clientstate_t *client,
@@ -83,7 +103,7 @@ int fsm_prepare_and_send_error_resp(clientstate_t *client,
 
   size_t response_size = sizeof(dbproto_hdr_t);
   if (out_buffer_size < response_size) {
-    fprintf(stderr, "Output buffer too small for ERROR response.\n");
+    log_error("Output buffer too small for ERROR response.");
     return STATUS_ERROR;
   }
 
@@ -94,161 +114,962 @@ int fsm_prepare_and_send_error_resp(clientstate_t *client,
   hdr->type = htons(hdr->type);
   hdr->len = htons(hdr->len);
 
-  return send_response(client->fd, out_buffer, response_size);
+  return send_response(client, out_buffer, response_size);
 }
 
 static void close_client_connection(clientstate_t *client) {
   if (client && client->fd >= 0) {
-    printf("Client %d: Closing connection.\n", client->fd);
+    log_debug("Client %d: Closing connection.", client->fd);
     close(client->fd);
     client->fd = -1;
     client->state = STATE_NEW;
     client->bytes_received = 0;
-    memset(client->buffer, 0, BUFF_SIZE);
+    client->listing = false;
+    client->out_head = 0;
+    client->out_len = 0;
+    client->out_ready = 0;
+    memset(client->buffer, 0, client->buffer_size);
   }
 }
 
-void handle_client_fsm(dbheader_t *dbhdr, employee_t **employees,
-                       clientstate_t *client, int dbfd) {
-  if (!client || client->fd < 0) {
-    fprintf(stderr, "handle_client_fsm: Invalid client state or fd.\n");
-    return;
+static bool query_matches(const database_t *db, const listquery_t *query,
+                          const dbrecord_t *rec) {
+  if (rec->hours < query->hours_min || rec->hours > query->hours_max) {
+    return false;
+  }
+  if (query->prefix_len > 0 &&
+      (rec->name_len < query->prefix_len ||
+       memcmp(record_name(db, rec), query->prefix, query->prefix_len) != 0)) {
+    return false;
+  }
+  if (query->substring_len > 0 &&
+      find_substring(record_address(db, rec), rec->address_len,
+                     query->substring, query->substring_len) == NULL) {
+    return false;
+  }
+  return true;
+}
+
+/* Index scans keep the next key to visit in list_cursor, so writes between
+   batches shift the position instead of invalidating it. */
+static size_t collect_hours_rows(database_t *db, clientstate_t *client,
+                                 uint32_t *rows) {
+  listquery_t *query = &client->query;
+  bool descending = query->order == LIST_BY_HOURS_DESC;
+  uint64_t from = descending ? hoursindex_key(query->hours_min, 0)
+                             : client->list_cursor;
+  uint64_t to = descending ? client->list_cursor
+                           : hoursindex_key(query->hours_max, UINT32_MAX);
+  uint64_t keys[LIST_BATCH_RECORDS];
+  size_t max = query->remaining < LIST_BATCH_RECORDS ? query->remaining
+                                                     : LIST_BATCH_RECORDS;
+
+  size_t n = hoursindex_scan(&db->hours, from, to, descending, keys, max);
+  for (size_t i = 0; i < n; i++) {
+    rows[i] = (uint32_t)keys[i];
+  }
+
+  query->remaining -= n;
+  if (n > 0) {
+    uint64_t last = keys[n - 1];
+    if (descending && last == 0) {
+      query->remaining = 0;
+    } else {
+      client->list_cursor = descending ? last - 1 : last + 1;
+    }
   }
+  return n;
+}
+
+static size_t collect_list_rows(database_t *db, clientstate_t *client,
+                                uint32_t *rows) {
+  listquery_t *query = &client->query;
+  uint64_t count = db->hdr->count;
+  size_t n = 0;
+
+  if (query->order != LIST_BY_ROW) {
+    return collect_hours_rows(db, client, rows);
+  }
+
+  while (n < LIST_BATCH_RECORDS && client->list_cursor < count &&
+         query->remaining > 0) {
+    uint64_t row = client->list_cursor++;
+    if (!query_matches(db, query, &db->records[row])) {
+      continue;
+    }
+    if (query->skip > 0) {
+      query->skip--;
+      continue;
+    }
+    rows[n++] = row;
+    query->remaining--;
+  }
+  return n;
+}
+
+static void fill_list_frame_v1(database_t *db, clientstate_t *client,
+                               const uint32_t *rows, size_t n) {
+  dbproto_hdr_t hdr;
+  hdr.type = htons(client->list_type);
+  hdr.len = htons(n);
+  send_response(client, &hdr, sizeof(hdr));
+
+  for (size_t i = 0; i < n; i++) {
+    const dbrecord_t *rec = &db->records[rows[i]];
+    dbproto_employee_list_resp record = {0};
+    memcpy(record.name, record_name(db, rec), rec->name_len);
+    memcpy(record.address, record_address(db, rec), rec->address_len);
+    record.hours = htonl(rec->hours);
+    send_response(client, &record, sizeof(record));
+  }
+}
+
+static void fill_list_frame_v2(database_t *db, clientstate_t *client,
+                               const uint32_t *rows, size_t n) {
+  const size_t prefix =
+      sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_batch_resp);
+  u_int8_t frame[sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_batch_resp) +
+                 LIST_BATCH_RECORDS * WIRE_EMPLOYEE_MAX];
+  size_t size = 0;
 
-  unsigned char *buffer_ptr = client->buffer;
-  dbproto_hdr_t *incoming_hdr = (dbproto_hdr_t *)buffer_ptr;
+  for (size_t i = 0; i < n; i++) {
+    const dbrecord_t *rec = &db->records[rows[i]];
+    wire_employee_t record = {.name = record_name(db, rec),
+                              .name_len = rec->name_len,
+                              .address = record_address(db, rec),
+                              .address_len = rec->address_len,
+                              .hours = rec->hours};
+    size += wire_encode_employee(frame + prefix + size, &record);
+  }
+
+  dbproto_hdr_t *hdr = (dbproto_hdr_t *)frame;
+  dbproto_employee_batch_resp *batch = (dbproto_employee_batch_resp *)&hdr[1];
+  hdr->type = htons(client->list_type);
+  hdr->len = htons(n);
+  batch->size = htonl(size);
+  send_response(client, frame, prefix + size);
+}
+
+static void fill_list_output(database_t *db, clientstate_t *client) {
+  const size_t frame_max =
+      client->proto == PROTO_VER_1
+          ? sizeof(dbproto_hdr_t) +
+                LIST_BATCH_RECORDS * sizeof(dbproto_employee_list_resp)
+          : sizeof(dbproto_hdr_t) + sizeof(dbproto_employee_batch_resp) +
+                LIST_BATCH_RECORDS * WIRE_EMPLOYEE_MAX;
+  bool ready = client->out_ready == client->out_len;
+  uint32_t rows[LIST_BATCH_RECORDS];
+
+  pthread_rwlock_rdlock(&db->lock);
+
+  while (client->listing && OUT_BUFF_SIZE - client->out_len >= frame_max) {
+    size_t n = collect_list_rows(db, client, rows);
+
+    if (client->proto == PROTO_VER_1) {
+      fill_list_frame_v1(db, client, rows, n);
+    } else {
+      fill_list_frame_v2(db, client, rows, n);
+    }
+
+    if (n == 0) {
+      client->listing = false;
+    }
+  }
+
+  pthread_rwlock_unlock(&db->lock);
+
+  if (ready) {
+    client->out_ready = client->out_len;
+  }
+}
+
+static void start_list(clientstate_t *client, u_int16_t type) {
+  client->listing = true;
+  client->list_cursor = 0;
+  client->list_type = type;
+  client->query.order = LIST_BY_ROW;
+  client->query.prefix_len = 0;
+  client->query.substring_len = 0;
+  client->query.hours_min = 0;
+  client->query.hours_max = UINT32_MAX;
+  client->query.skip = 0;
+  client->query.remaining = UINT64_MAX;
+}
+
+void release_client_output(clientstate_t *client) {
+  client->out_ready = client->out_len;
+}
+
+bool client_wants_input(const clientstate_t *client) {
+  return client->fd >= 0 && client->state != STATE_CLOSING &&
+         !client->listing && client->out_len < OUT_HIGH_WATERMARK;
+}
+
+int flush_client_output(database_t *db, clientstate_t *client) {
+  while (client->fd >= 0) {
+    if (client->listing) {
+      fill_list_output(db, client);
+    }
+
+    if (client->out_ready == 0) {
+      if (client->state == STATE_CLOSING && client->out_len == 0) {
+        close_client_connection(client);
+      }
+      return STATUS_SUCCESS;
+    }
+
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    size_t first = OUT_BUFF_SIZE - client->out_head;
+    if (first > client->out_ready)
+      first = client->out_ready;
+
+    iov[0].iov_base = client->outbuf + client->out_head;
+    iov[0].iov_len = first;
+    iov[1].iov_base = client->outbuf;
+    iov[1].iov_len = client->out_ready - first;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov[1].iov_len > 0 ? 2 : 1;
+
+    uint64_t start = metrics_now();
+    ssize_t bytes_written = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+    if (bytes_written == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return STATUS_SUCCESS;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      log_error("flush_client_output: write failed: %m");
+      close_client_connection(client);
+      return STATUS_ERROR;
+    }
+
+    metrics_phase(METRIC_SEND, metrics_now() - start);
+    metrics_bytes_out(bytes_written);
+    client->out_head = (client->out_head + bytes_written) % OUT_BUFF_SIZE;
+    client->out_len -= bytes_written;
+    client->out_ready -= bytes_written;
+    if (client->out_len == 0) {
+      client->out_head = 0;
+    }
+  }
+  return STATUS_ERROR;
+}
+
+static size_t message_payload_size(const clientstate_t *client,
+                                   u_int16_t msg_type) {
+  switch (msg_type) {
+  case MSG_HELLO_REQ:
+    return sizeof(dbproto_hello_req);
+  case MSG_EMPLOYEE_ADD_REQ:
+    return client->proto == PROTO_VER_1 ? sizeof(dbproto_employee_add_req) : 0;
+  case MSG_EMPLOYEE_ADD_BATCH_REQ:
+    return sizeof(dbproto_employee_batch_req);
+  case MSG_EMPLOYEE_STATS_REQ:
+    return sizeof(dbproto_employee_stats_req);
+  case MSG_EMPLOYEE_QUERY_REQ:
+    return sizeof(dbproto_employee_query_req);
+  case MSG_EMPLOYEE_RANGE_REQ:
+    return sizeof(dbproto_employee_range_req);
+  case MSG_EMPLOYEE_UPDATE_REQ:
+    return sizeof(dbproto_employee_update_req);
+  default:
+    return 0;
+  }
+}
+
+static size_t message_body_size(const clientstate_t *client,
+                                const dbproto_hdr_t *hdr) {
+  switch (ntohs(hdr->type)) {
+  case MSG_EMPLOYEE_ADD_REQ:
+    return client->proto == PROTO_VER_1 ? 0 : ntohs(hdr->len);
+  case MSG_EMPLOYEE_ADD_BATCH_REQ: {
+    const dbproto_employee_batch_req *req =
+        (const dbproto_employee_batch_req *)&hdr[1];
+    u_int32_t size = ntohl(req->size);
+    return size <= BATCH_MAX_BYTES ? size : 0;
+  }
+  case MSG_EMPLOYEE_UPDATE_REQ:
+  case MSG_EMPLOYEE_DEL_REQ:
+    return ntohs(hdr->len) <= WIRE_FIELD_MAX ? ntohs(hdr->len) : 0;
+  case MSG_EMPLOYEE_QUERY_REQ: {
+    const dbproto_employee_query_req *req =
+        (const dbproto_employee_query_req *)&hdr[1];
+    u_int16_t prefix_len = ntohs(req->prefix_len);
+    u_int16_t substring_len = ntohs(req->substring_len);
+    if (prefix_len > WIRE_FIELD_MAX || substring_len > WIRE_FIELD_MAX) {
+      return 0;
+    }
+    return prefix_len + substring_len;
+  }
+  default:
+    return 0;
+  }
+}
+
+static int fsm_add_employee_batch(database_t *db, clientstate_t *client,
+                                  const unsigned char *buffer_ptr) {
+  const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)buffer_ptr;
+  const dbproto_employee_batch_req *req =
+      (const dbproto_employee_batch_req *)&hdr[1];
+  const u_int8_t *records = (const u_int8_t *)&req[1];
+  u_int16_t count = ntohs(hdr->len);
+  u_int32_t size = ntohl(req->size);
+  u_int8_t bitmap[(UINT16_MAX + 8) / 8];
+  size_t bitmap_size = (count + 7) / 8;
+  size_t valid = 0;
+
+  if (size > BATCH_MAX_BYTES) {
+    log_warn("Client %d: Batch of %u bytes exceeds the limit.", client->fd,
+             size);
+    return STATUS_ERROR;
+  }
+
+  memset(bitmap, 0, bitmap_size);
+
+  size_t offset = 0;
+  for (u_int16_t i = 0; i < count; i++) {
+    wire_employee_t record;
+    employee_t employee;
+    size_t n = wire_decode_employee(records + offset, size - offset, &record);
+    if (n == 0) {
+      break;
+    }
+    offset += n;
+    if (employee_from_wire(&record, &employee) == STATUS_SUCCESS) {
+      bitmap[i / 8] |= 1 << (i % 8);
+      valid++;
+    }
+  }
+
+  pthread_rwlock_wrlock(&db->lock);
+  if (grow_employees(db, db->hdr->count + valid) != STATUS_SUCCESS) {
+    memset(bitmap, 0, bitmap_size);
+    valid = 0;
+  }
+
+  offset = 0;
+  for (u_int16_t i = 0; i < count; i++) {
+    wire_employee_t record;
+    employee_t employee;
+    size_t n = wire_decode_employee(records + offset, size - offset, &record);
+    if (n == 0) {
+      break;
+    }
+    offset += n;
+    if ((bitmap[i / 8] & (1 << (i % 8))) == 0) {
+      continue;
+    }
+    employee_from_wire(&record, &employee);
+    if (insert_employee(db, &employee) != STATUS_SUCCESS) {
+      bitmap[i / 8] &= ~(1 << (i % 8));
+      valid--;
+    }
+  }
+  pthread_rwlock_unlock(&db->lock);
+
+  log_debug("Client %d: Added %zu of %u employees in batch.", client->fd, valid,
+            count);
+
+  if (db->wal->sync == WAL_SYNC_ALWAYS && db_commit(db) != STATUS_SUCCESS) {
+    log_error(
+        "Client %d: Batch added, BUT FAILED TO COMMIT THE WRITE-AHEAD LOG!",
+        client->fd);
+  }
+
+  dbproto_hdr_t resp;
+  resp.type = htons(MSG_EMPLOYEE_ADD_BATCH_RESP);
+  resp.len = htons(count);
+  if (send_response(client, &resp, sizeof(resp)) != STATUS_SUCCESS ||
+      send_response(client, bitmap, bitmap_size) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+static int fsm_employee_stats(database_t *db, clientstate_t *client,
+                              const unsigned char *buffer_ptr) {
+  const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)buffer_ptr;
+  const dbproto_employee_stats_req *req =
+      (const dbproto_employee_stats_req *)&hdr[1];
+  u_int32_t shift = ntohl(req->bucket_shift);
+  hours_stats_t stats;
+
+  if (shift > STATS_SHIFT_MAX) {
+    log_warn("Client %d: Bad histogram bucket shift %u.", client->fd, shift);
+    return STATUS_ERROR;
+  }
+
+  log_debug("Client %d: Received STATS_REQ.", client->fd);
+
+  pthread_rwlock_rdlock(&db->lock);
+  if (db->columns != NULL) {
+    stats_hours(db->columns->hours, db->hdr->count, shift, &stats);
+  } else {
+    stats_records(db->records, db->hdr->count, shift, &stats);
+  }
+  pthread_rwlock_unlock(&db->lock);
+
+  struct {
+    dbproto_hdr_t hdr;
+    dbproto_employee_stats_resp stats;
+  } resp;
+  resp.hdr.type = htons(MSG_EMPLOYEE_STATS_RESP);
+  resp.hdr.len = htons(1);
+  resp.stats.sum = htobe64(stats.sum);
+  resp.stats.count = htonl(stats.count);
+  resp.stats.min = htonl(stats.min);
+  resp.stats.max = htonl(stats.max);
+  resp.stats.bucket_shift = htonl(shift);
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    resp.stats.buckets[i] = htonl(stats.buckets[i]);
+  }
+  return send_response(client, &resp, sizeof(resp));
+}
+
+static int fsm_employee_query(clientstate_t *client,
+                              const unsigned char *buffer_ptr) {
+  const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)buffer_ptr;
+  const dbproto_employee_query_req *req =
+      (const dbproto_employee_query_req *)&hdr[1];
+  const char *strings = (const char *)&req[1];
+  u_int16_t prefix_len = ntohs(req->prefix_len);
+  u_int16_t substring_len = ntohs(req->substring_len);
+  u_int32_t limit = ntohl(req->limit);
+
+  if (prefix_len > WIRE_FIELD_MAX || substring_len > WIRE_FIELD_MAX) {
+    log_warn("Client %d: Query strings are too long.", client->fd);
+    return STATUS_ERROR;
+  }
+
+  log_debug("Client %d: Received QUERY_REQ.", client->fd);
+
+  start_list(client, MSG_EMPLOYEE_QUERY_RESP);
+  listquery_t *query = &client->query;
+  memcpy(query->prefix, strings, prefix_len);
+  memcpy(query->substring, strings + prefix_len, substring_len);
+  query->prefix_len = prefix_len;
+  query->substring_len = substring_len;
+  query->hours_min = ntohl(req->hours_min);
+  query->hours_max = ntohl(req->hours_max);
+  query->skip = ntohl(req->offset);
+  query->remaining = limit > 0 ? limit : UINT64_MAX;
+  return STATUS_SUCCESS;
+}
+
+/* UPDATE and DELETE name the employee with `len` bytes after the payload.
+   The response's `len` is the number of records changed, 0 or 1. */
+static int decode_employee_name(const clientstate_t *client,
+                                const unsigned char *buffer_ptr,
+                                size_t payload_size, char *name) {
+  const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)buffer_ptr;
+  u_int16_t len = ntohs(hdr->len);
+
+  if (len == 0 || len > WIRE_FIELD_MAX) {
+    log_warn("Client %d: Bad employee name length %u.", client->fd, len);
+    return STATUS_ERROR;
+  }
+
+  const char *bytes = (const char *)&hdr[1] + payload_size;
+  if (memchr(bytes, '\0', len) != NULL) {
+    log_warn("Client %d: Employee name contains NUL.", client->fd);
+    return STATUS_ERROR;
+  }
+  memcpy(name, bytes, len);
+  name[len] = '\0';
+  return STATUS_SUCCESS;
+}
+
+static int send_change_resp(database_t *db, clientstate_t *client,
+                            u_int16_t type, u_int16_t changed) {
+  if (changed > 0 && db->wal->sync == WAL_SYNC_ALWAYS &&
+      db_commit(db) != STATUS_SUCCESS) {
+    log_error("Client %d: Employee changed, BUT FAILED TO COMMIT THE "
+              "WRITE-AHEAD LOG!", client->fd);
+  }
+
+  dbproto_hdr_t resp;
+  resp.type = htons(type);
+  resp.len = htons(changed);
+  return send_response(client, &resp, sizeof(resp));
+}
+
+static int fsm_update_employee(database_t *db, clientstate_t *client,
+                               const unsigned char *buffer_ptr) {
+  const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)buffer_ptr;
+  const dbproto_employee_update_req *req =
+      (const dbproto_employee_update_req *)&hdr[1];
+  char name[WIRE_FIELD_MAX + 1];
+  u_int16_t changed = 0;
+
+  if (decode_employee_name(client, buffer_ptr, sizeof(*req), name) !=
+      STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  log_debug("Client %d: Received UPDATE_REQ for employee: \"%s\"", client->fd,
+            name);
+
+  pthread_rwlock_wrlock(&db->lock);
+  if (nameindex_find(&db->index, db, name) != STATUS_ERROR) {
+    if (set_employee_hours(db, name, ntohl(req->hours)) != STATUS_SUCCESS) {
+      pthread_rwlock_unlock(&db->lock);
+      log_error("Client %d: Failed to update employee internally.", client->fd);
+      return STATUS_ERROR;
+    }
+    changed = 1;
+  }
+  pthread_rwlock_unlock(&db->lock);
+
+  return send_change_resp(db, client, MSG_EMPLOYEE_UPDATE_RESP, changed);
+}
+
+static int fsm_delete_employee(database_t *db, clientstate_t *client,
+                               const unsigned char *buffer_ptr) {
+  char name[WIRE_FIELD_MAX + 1];
+  u_int16_t changed = 0;
+
+  if (decode_employee_name(client, buffer_ptr, 0, name) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  log_debug("Client %d: Received DEL_REQ for employee: \"%s\"", client->fd,
+            name);
+
+  pthread_rwlock_wrlock(&db->lock);
+  if (nameindex_find(&db->index, db, name) != STATUS_ERROR) {
+    if (delete_employee(db, name) != STATUS_SUCCESS) {
+      pthread_rwlock_unlock(&db->lock);
+      log_error("Client %d: Failed to delete employee internally.", client->fd);
+      return STATUS_ERROR;
+    }
+    changed = 1;
+  }
+  pthread_rwlock_unlock(&db->lock);
+
+  return send_change_resp(db, client, MSG_EMPLOYEE_DEL_RESP, changed);
+}
+
+static int fsm_server_stats(clientstate_t *client) {
+  char *text = malloc(METRICS_TEXT_MAX);
+  if (text == NULL) {
+    log_error("Failed to allocate metrics buffer: %m");
+    return STATUS_ERROR;
+  }
+
+  log_debug("Client %d: Received STATS_REQ.", client->fd);
+
+  size_t len = metrics_format(text, METRICS_TEXT_MAX);
+  struct {
+    dbproto_hdr_t hdr;
+    dbproto_stats_resp stats;
+  } resp;
+  resp.hdr.type = htons(MSG_STATS_RESP);
+  resp.hdr.len = htons(1);
+  resp.stats.size = htonl(len);
+
+  int ret = STATUS_ERROR;
+  if (OUT_BUFF_SIZE - client->out_len < sizeof(resp) + len) {
+    log_warn("Client %d: No room for a %zu byte metrics response.", client->fd,
+             len);
+  } else {
+    send_response(client, &resp, sizeof(resp));
+    ret = send_response(client, text, len);
+  }
+  free(text);
+  return ret;
+}
+
+/* The response's len is 1 if this request started a save and 0 if one was
+   already queued or running. */
+static int fsm_save(database_t *db, clientstate_t *client) {
+  log_debug("Client %d: Received SAVE_REQ.", client->fd);
+
+  dbproto_hdr_t resp;
+  resp.type = htons(MSG_SAVE_RESP);
+  resp.len = htons(db_save(db) ? 1 : 0);
+  return send_response(client, &resp, sizeof(resp));
+}
+
+static void fsm_employee_range(clientstate_t *client,
+                               const unsigned char *buffer_ptr) {
+  const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)buffer_ptr;
+  const dbproto_employee_range_req *req =
+      (const dbproto_employee_range_req *)&hdr[1];
+  u_int32_t limit = ntohl(req->limit);
+
+  log_debug("Client %d: Received RANGE_REQ.", client->fd);
+
+  start_list(client, MSG_EMPLOYEE_RANGE_RESP);
+  listquery_t *query = &client->query;
+  query->hours_min = ntohl(req->hours_min);
+  query->hours_max = ntohl(req->hours_max);
+  query->remaining = limit > 0 ? limit : UINT64_MAX;
+  if (ntohl(req->descending)) {
+    query->order = LIST_BY_HOURS_DESC;
+    client->list_cursor = hoursindex_key(query->hours_max, UINT32_MAX);
+  } else {
+    query->order = LIST_BY_HOURS_ASC;
+    client->list_cursor = hoursindex_key(query->hours_min, 0);
+  }
+}
+
+static int decode_add_request(const clientstate_t *client,
+                              const unsigned char *buffer_ptr,
+                              employee_t *employee) {
+  const dbproto_hdr_t *hdr = (const dbproto_hdr_t *)buffer_ptr;
+
+  if (client->proto == PROTO_VER_1) {
+    const dbproto_employee_add_req *employee_payload =
+        (const dbproto_employee_add_req *)&hdr[1];
+    span_t input = {(const char *)employee_payload->data,
+                    strnlen((const char *)employee_payload->data,
+                            sizeof(employee_payload->data))};
+
+    log_debug("Client %d: Received ADD_REQ for employee: \"%.*s\"", client->fd,
+              (int)input.len, input.ptr);
+
+    return parse_employee_span(input, employee);
+  }
+
+  wire_employee_t record;
+  size_t len = ntohs(hdr->len);
+  if (wire_decode_employee((const u_int8_t *)&hdr[1], len, &record) != len) {
+    return STATUS_ERROR;
+  }
+
+  log_debug("Client %d: Received ADD_REQ for employee: \"%.*s\"", client->fd,
+            (int)record.name_len, record.name);
+
+  return employee_from_wire(&record, employee);
+}
+
+static void handle_client_message(database_t *db, clientstate_t *client,
+                                  const unsigned char *buffer_ptr) {
+  unsigned char response[RESP_BUFF_SIZE];
+  const dbproto_hdr_t *incoming_hdr = (const dbproto_hdr_t *)buffer_ptr;
 
   u_int16_t msg_type = ntohs(incoming_hdr->type);
   u_int16_t msg_len = ntohs(incoming_hdr->len);
 
   if (client->state == STATE_HELLO) {
     if (msg_type != MSG_HELLO_REQ || msg_len != 1) {
-      fprintf(stderr,
-              "Client %d: Expected MSG_HELLO_REQ(len=1) in STATE_HELLO, got "
-              "type %u (len=%u)\n",
-              client->fd, msg_type, msg_len);
-      if (fsm_prepare_and_send_error_resp(client, client->buffer, BUFF_SIZE,
+      log_warn("Client %d: Expected MSG_HELLO_REQ(len=1) in STATE_HELLO, got "
+               "type %u (len=%u)", client->fd, msg_type, msg_len);
+      if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
                                           msg_type) != STATUS_SUCCESS) {
+        close_client_connection(client);
+        return;
       }
-      close_client_connection(client);
-      return;
-    }
-
-    if (client->bytes_received <
-        sizeof(dbproto_hdr_t) + sizeof(dbproto_hello_req)) {
-      fprintf(stderr,
-              "Client %d: Incomplete HELLO_REQ message (expected header + "
-              "payload).\n",
-              client->fd);
+      client->state = STATE_CLOSING;
       return;
     }
 
-    dbproto_hello_req *hello_payload =
-        (dbproto_hello_req *)(buffer_ptr + sizeof(dbproto_hdr_t));
+    const dbproto_hello_req *hello_payload =
+        (const dbproto_hello_req *)(buffer_ptr + sizeof(dbproto_hdr_t));
     u_int16_t client_proto_ver = ntohs(hello_payload->proto);
 
-    if (client_proto_ver != PROTO_VER) {
-      fprintf(stderr,
-              "Client %d: Protocol version mismatch. Expected %u, got %u\n",
-              client->fd, PROTO_VER, client_proto_ver);
-      if (fsm_prepare_and_send_error_resp(client, client->buffer, BUFF_SIZE,
+    if (client_proto_ver != PROTO_VER_1 && client_proto_ver != PROTO_VER_2) {
+      log_warn(
+          "Client %d: Protocol version mismatch. Expected %u or %u, got %u",
+          client->fd, PROTO_VER_1, PROTO_VER_2, client_proto_ver);
+      if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
                                           msg_type) != STATUS_SUCCESS) {
+        close_client_connection(client);
+        return;
       }
-      close_client_connection(client);
+      client->state = STATE_CLOSING;
       return;
     }
 
-    if (fsm_prepare_and_send_hello_resp(client, client->buffer, BUFF_SIZE) !=
+    client->proto = client_proto_ver;
+    if (fsm_prepare_and_send_hello_resp(client, response, sizeof(response)) !=
         STATUS_SUCCESS) {
       close_client_connection(client);
       return;
     }
     client->state = STATE_MSG;
-    printf("Client %d: Upgraded to STATE_MSG.\n", client->fd);
+    log_debug("Client %d: Upgraded to STATE_MSG.", client->fd);
+    return;
   }
 
   if (client->state == STATE_MSG) {
     if (msg_type == MSG_EMPLOYEE_ADD_REQ) {
-      dbproto_employee_add_req *employee_payload =
-          (dbproto_employee_add_req *)(buffer_ptr + sizeof(dbproto_hdr_t));
-
-      char safe_employee_data[sizeof(employee_payload->data) + 1];
-      memcpy(safe_employee_data, employee_payload->data,
-             sizeof(employee_payload->data));
-      safe_employee_data[sizeof(employee_payload->data)] = '\0';
+      employee_t employee;
+      if (decode_add_request(client, buffer_ptr, &employee) != STATUS_SUCCESS) {
+        log_warn("Client %d: Malformed employee record.", client->fd);
+        if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
+                                            msg_type) != STATUS_SUCCESS) {
+          close_client_connection(client);
+          return;
+        }
+        client->state = STATE_CLOSING;
+        return;
+      }
 
-      printf("Client %d: Received ADD_REQ for employee: \"%.*s\"\n", client->fd,
-             (int)strnlen(safe_employee_data, sizeof(safe_employee_data) - 1),
-             safe_employee_data);
+      pthread_rwlock_wrlock(&db->lock);
+      int added = insert_employee(db, &employee);
+      pthread_rwlock_unlock(&db->lock);
 
-      if (add_employee(dbhdr, employees, safe_employee_data) !=
-          STATUS_SUCCESS) {
-        fprintf(stderr, "Client %d: Failed to add employee internally.\n",
-                client->fd);
+      if (added != STATUS_SUCCESS) {
+        log_error("Client %d: Failed to add employee internally.", client->fd);
         close_client_connection(client);
         return;
       }
 
-      if (fsm_prepare_and_send_add_resp(client, client->buffer, BUFF_SIZE) !=
+      if (db->wal->sync == WAL_SYNC_ALWAYS && db_commit(db) != STATUS_SUCCESS) {
+        log_error("Client %d: Employee added, BUT FAILED TO COMMIT THE "
+                  "WRITE-AHEAD LOG!", client->fd);
+      }
+
+      if (fsm_prepare_and_send_add_resp(client, response, sizeof(response)) !=
           STATUS_SUCCESS) {
-        fprintf(stderr,
-                "Client %d: Employee added, but FAILED to send ADD_RESP.\n",
-                client->fd);
+        log_error("Client %d: Employee added, but FAILED to send ADD_RESP.",
+                  client->fd);
         close_client_connection(client);
         return;
       }
+    } else if (msg_type == MSG_EMPLOYEE_ADD_BATCH_REQ) {
+      if (fsm_add_employee_batch(db, client, buffer_ptr) != STATUS_SUCCESS) {
+        if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
+                                            msg_type) != STATUS_SUCCESS) {
+          close_client_connection(client);
+          return;
+        }
+        client->state = STATE_CLOSING;
+        return;
+      }
+    } else if (msg_type == MSG_EMPLOYEE_UPDATE_REQ ||
+               msg_type == MSG_EMPLOYEE_DEL_REQ) {
+      int changed = msg_type == MSG_EMPLOYEE_UPDATE_REQ
+                        ? fsm_update_employee(db, client, buffer_ptr)
+                        : fsm_delete_employee(db, client, buffer_ptr);
+      if (changed != STATUS_SUCCESS) {
+        if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
+                                            msg_type) != STATUS_SUCCESS) {
+          close_client_connection(client);
+          return;
+        }
+        client->state = STATE_CLOSING;
+        return;
+      }
+    } else if (msg_type == MSG_STATS_REQ) {
+      if (fsm_server_stats(client) != STATUS_SUCCESS) {
+        if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
+                                            msg_type) != STATUS_SUCCESS) {
+          close_client_connection(client);
+          return;
+        }
+        client->state = STATE_CLOSING;
+        return;
+      }
+    } else if (msg_type == MSG_SAVE_REQ) {
+      if (fsm_save(db, client) != STATUS_SUCCESS) {
+        if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
+                                            msg_type) != STATUS_SUCCESS) {
+          close_client_connection(client);
+          return;
+        }
+        client->state = STATE_CLOSING;
+        return;
+      }
+    } else if (msg_type == MSG_EMPLOYEE_STATS_REQ) {
+      if (fsm_employee_stats(db, client, buffer_ptr) != STATUS_SUCCESS) {
+        if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
+                                            msg_type) != STATUS_SUCCESS) {
+          close_client_connection(client);
+          return;
+        }
+        client->state = STATE_CLOSING;
+        return;
+      }
+    } else if (msg_type == MSG_EMPLOYEE_LIST_REQ) {
+      log_debug("Client %d: Received LIST_REQ.", client->fd);
 
-      printf("Client %d: Employee added successfully. Saving to file...\n",
-             client->fd);
-      if (output_file(dbfd, dbhdr, *employees) != STATUS_SUCCESS) {
-        fprintf(stderr,
-                "CRITICAL: Client %d: Employee added and client notified, BUT "
-                "FAILED TO SAVE DATABASE TO FILE!\n",
-                client->fd);
-      } else {
-        printf("Client %d: Database saved to file successfully.\n", client->fd);
+      start_list(client, MSG_EMPLOYEE_LIST_RESP);
+    } else if (msg_type == MSG_EMPLOYEE_RANGE_REQ) {
+      fsm_employee_range(client, buffer_ptr);
+    } else if (msg_type == MSG_EMPLOYEE_QUERY_REQ) {
+      if (fsm_employee_query(client, buffer_ptr) != STATUS_SUCCESS) {
+        if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
+                                            msg_type) != STATUS_SUCCESS) {
+          close_client_connection(client);
+          return;
+        }
+        client->state = STATE_CLOSING;
+        return;
       }
     } else {
-      fprintf(stderr, "Client %d: Unknown message type %u in STATE_MSG.\n",
-              client->fd, msg_type);
-      if (fsm_prepare_and_send_error_resp(client, client->buffer, BUFF_SIZE,
+      log_warn("Client %d: Unknown message type %u in STATE_MSG.", client->fd,
+               msg_type);
+      if (fsm_prepare_and_send_error_resp(client, response, sizeof(response),
                                           msg_type) != STATUS_SUCCESS) {
+        close_client_connection(client);
+        return;
       }
-      close_client_connection(client);
+      client->state = STATE_CLOSING;
       return;
     }
   }
 }
 
-void init_clients(clientstate_t *states) {
-  if (!states)
+static int grow_client_buffer(clientstate_t *client, size_t size) {
+  unsigned char *buffer = realloc(client->buffer, size);
+  if (buffer == NULL) {
+    log_error("Failed to grow client input buffer: %m");
+    return STATUS_ERROR;
+  }
+  client->buffer = buffer;
+  client->buffer_size = size;
+  return STATUS_SUCCESS;
+}
+
+void handle_client_fsm(database_t *db, clientstate_t *client) {
+  size_t offset = 0;
+  uint64_t start = metrics_now();
+  uint64_t handled = 0;
+
+  while (client_wants_input(client) &&
+         client->bytes_received - offset >= sizeof(dbproto_hdr_t)) {
+    const dbproto_hdr_t *hdr =
+        (const dbproto_hdr_t *)(client->buffer + offset);
+    u_int16_t msg_type = ntohs(hdr->type);
+    size_t frame_len =
+        sizeof(dbproto_hdr_t) + message_payload_size(client, msg_type);
+
+    if (client->bytes_received - offset < frame_len) {
+      break;
+    }
+    frame_len += message_body_size(client, hdr);
+
+    if (client->bytes_received - offset < frame_len) {
+      if (frame_len > client->buffer_size &&
+          grow_client_buffer(client, frame_len) != STATUS_SUCCESS) {
+        close_client_connection(client);
+        return;
+      }
+      break;
+    }
+
+    uint64_t msg_start = metrics_now();
+    handle_client_message(db, client, client->buffer + offset);
+    uint64_t elapsed = metrics_now() - msg_start;
+    metrics_message(msg_type, elapsed,
+                    client->fd >= 0 && client->state != STATE_CLOSING);
+    handled += elapsed;
+    offset += frame_len;
+  }
+
+  /* Whatever the handlers did not account for went to framing. */
+  if (offset > 0) {
+    metrics_phase(METRIC_PARSE, metrics_now() - start - handled);
+  }
+
+  if (client->fd < 0) {
     return;
-  for (int i = 0; i < MAX_CLIENTS; i++) {
-    states[i].fd = -1;
-    states[i].state = STATE_NEW;
-    states[i].bytes_received = 0;
-    memset(states[i].buffer, 0, BUFF_SIZE);
+  }
+
+  if (offset > 0) {
+    memmove(client->buffer, client->buffer + offset,
+            client->bytes_received - offset);
+    client->bytes_received -= offset;
   }
 }
 
-int find_free_slot(const clientstate_t *states) {
-  if (!states)
-    return -1;
-  for (int i = 0; i < MAX_CLIENTS; i++) {
-    if (states[i].fd == -1) {
-      return i;
+int init_client_table(clienttable_t *table, size_t capacity) {
+  if (!table)
+    return STATUS_ERROR;
+  if (capacity == 0)
+    capacity = CLIENT_TABLE_INIT;
+
+  table->clients = calloc(capacity, sizeof(clientstate_t *));
+  if (table->clients == NULL) {
+    log_error("Failed to allocate client table: %m");
+    return STATUS_ERROR;
+  }
+  table->count = 0;
+  table->capacity = capacity;
+  return STATUS_SUCCESS;
+}
+
+clientstate_t *acquire_client(clienttable_t *table, int fd) {
+  if (!table || fd < 0)
+    return NULL;
+
+  if (table->count == table->capacity) {
+    size_t new_capacity = table->capacity * 2;
+    clientstate_t **tmp =
+        realloc(table->clients, new_capacity * sizeof(clientstate_t *));
+    if (tmp == NULL) {
+      log_error("Failed to grow client table: %m");
+      return NULL;
     }
+    table->clients = tmp;
+    table->capacity = new_capacity;
+  }
+
+  clientstate_t *client = malloc(sizeof(clientstate_t));
+  if (client == NULL) {
+    log_error("Failed to allocate client state: %m");
+    return NULL;
+  }
+  client->buffer = malloc(BUFF_SIZE);
+  if (client->buffer == NULL) {
+    log_error("Failed to allocate client input buffer: %m");
+    free(client);
+    return NULL;
   }
-  return -1;
+  client->buffer_size = BUFF_SIZE;
+  client->fd = fd;
+  client->state = STATE_HELLO;
+  client->proto = 0;
+  client->bytes_received = 0;
+  client->slot = table->count;
+  client->outbuf = NULL;
+  client->out_head = 0;
+  client->out_len = 0;
+  client->out_ready = 0;
+  client->listing = false;
+  client->list_cursor = 0;
+  client->commit_batch = 0;
+  client->queued = false;
+  client->next_pending = NULL;
+  client->waiting = false;
+  client->wait_prev = NULL;
+  client->wait_next = NULL;
+
+  table->clients[table->count++] = client;
+  return client;
 }
 
-int find_slot_by_fd(const clientstate_t *states, int fd) {
-  if (!states || fd < 0)
-    return -1;
-  for (int i = 0; i < MAX_CLIENTS; i++) {
-    if (states[i].fd == fd) {
-      return i;
+void release_client(clienttable_t *table, clientstate_t *client) {
+  if (!table || !client || client->slot >= table->count)
+    return;
+
+  clientstate_t *last = table->clients[table->count - 1];
+  table->clients[client->slot] = last;
+  last->slot = client->slot;
+  table->count--;
+
+  free(client->buffer);
+  free(client->outbuf);
+  free(client);
+}
+
+void free_client_table(clienttable_t *table) {
+  if (!table || !table->clients)
+    return;
+  for (size_t i = 0; i < table->count; i++) {
+    if (table->clients[i]->fd >= 0) {
+      close(table->clients[i]->fd);
     }
+    free(table->clients[i]->buffer);
+    free(table->clients[i]->outbuf);
+    free(table->clients[i]);
   }
-  return -1;
+  free(table->clients);
+  table->clients = NULL;
+  table->count = 0;
+  table->capacity = 0;
 }
@@ -0,0 +1,122 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STATS_HAVE_AVX2 1
+#endif
+
+#include "stats.h"
+
+static void stats_init(hours_stats_t *out, size_t count) {
+  memset(out, 0, sizeof(*out));
+  out->count = count;
+  out->min = UINT32_MAX;
+}
+
+static void stats_finish(hours_stats_t *out) {
+  if (out->count == 0) {
+    out->min = 0;
+  }
+}
+
+static inline void stats_add(hours_stats_t *out, uint32_t hours,
+                             unsigned int shift) {
+  uint32_t bucket = hours >> shift;
+  if (bucket > STATS_BUCKETS - 1)
+    bucket = STATS_BUCKETS - 1;
+
+  out->sum += hours;
+  if (hours < out->min)
+    out->min = hours;
+  if (hours > out->max)
+    out->max = hours;
+  out->buckets[bucket]++;
+}
+
+#ifdef STATS_HAVE_AVX2
+/* Every bucket keeps a vector of per-lane counters bumped by a compare, so
+   the histogram needs no scattered increments. */
+__attribute__((target("avx2"))) static size_t
+stats_avx2(const uint32_t *hours, size_t count, unsigned int shift,
+           hours_stats_t *out) {
+  __m256i vmin = _mm256_set1_epi32(-1);
+  __m256i vmax = _mm256_setzero_si256();
+  __m256i sum_lo = _mm256_setzero_si256();
+  __m256i sum_hi = _mm256_setzero_si256();
+  __m256i cap = _mm256_set1_epi32(STATS_BUCKETS - 1);
+  __m128i vshift = _mm_cvtsi32_si128(shift);
+  __m256i counts[STATS_BUCKETS];
+  size_t i = 0;
+
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    counts[b] = _mm256_setzero_si256();
+  }
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(hours + i));
+    vmin = _mm256_min_epu32(vmin, v);
+    vmax = _mm256_max_epu32(vmax, v);
+    sum_lo = _mm256_add_epi64(
+        sum_lo, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)));
+    sum_hi = _mm256_add_epi64(
+        sum_hi, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1)));
+
+    __m256i bucket = _mm256_min_epu32(_mm256_srl_epi32(v, vshift), cap);
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+      counts[b] = _mm256_sub_epi32(
+          counts[b], _mm256_cmpeq_epi32(bucket, _mm256_set1_epi32(b)));
+    }
+  }
+
+  uint32_t mins[8], maxs[8];
+  uint64_t sums[4];
+  _mm256_storeu_si256((__m256i *)mins, vmin);
+  _mm256_storeu_si256((__m256i *)maxs, vmax);
+  _mm256_storeu_si256((__m256i *)sums, _mm256_add_epi64(sum_lo, sum_hi));
+
+  for (int l = 0; l < 4; l++) {
+    out->sum += sums[l];
+  }
+  for (int l = 0; l < 8; l++) {
+    if (mins[l] < out->min)
+      out->min = mins[l];
+    if (maxs[l] > out->max)
+      out->max = maxs[l];
+  }
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    uint32_t lane_counts[8];
+    _mm256_storeu_si256((__m256i *)lane_counts, counts[b]);
+    for (int l = 0; l < 8; l++) {
+      out->buckets[b] += lane_counts[l];
+    }
+  }
+  return i;
+}
+#endif
+
+void stats_hours(const uint32_t *hours, size_t count, unsigned int shift,
+                 hours_stats_t *out) {
+  size_t i = 0;
+
+  stats_init(out, count);
+#ifdef STATS_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    i = stats_avx2(hours, count, shift, out);
+  }
+#endif
+  for (; i < count; i++) {
+    stats_add(out, hours[i], shift);
+  }
+  stats_finish(out);
+}
+
+void stats_records(const dbrecord_t *records, size_t count,
+                   unsigned int shift, hours_stats_t *out) {
+  stats_init(out, count);
+  for (size_t i = 0; i < count; i++) {
+    stats_add(out, records[i].hours, shift);
+  }
+  stats_finish(out);
+}
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nargs) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+/* Kernels before 5.6 have rings but no IORING_OP_WRITE. */
+static int probe_ops(uring_t *ring) {
+  size_t size = sizeof(struct io_uring_probe) +
+                IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  if (probe == NULL) {
+    return STATUS_ERROR;
+  }
+
+  int ret = STATUS_ERROR;
+  if (sys_register(ring->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) ==
+          0 &&
+      probe->ops_len > IORING_OP_WRITE &&
+      (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) &&
+      (probe->ops[IORING_OP_FSYNC].flags & IO_URING_OP_SUPPORTED)) {
+    ret = STATUS_SUCCESS;
+  } else {
+    errno = EOPNOTSUPP;
+  }
+  free(probe);
+  return ret;
+}
+
+int uring_init(uring_t *ring, unsigned entries) {
+  struct io_uring_params params;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&params, 0, sizeof(params));
+  ring->sq_ring = MAP_FAILED;
+  ring->cq_ring = MAP_FAILED;
+  ring->sqes = MAP_FAILED;
+
+  ring->fd = sys_setup(entries, &params);
+  if (ring->fd == -1) {
+    return STATUS_ERROR;
+  }
+
+  ring->sq_ring_len =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_len =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_len > ring->sq_ring_len) {
+      ring->sq_ring_len = ring->cq_ring_len;
+    }
+    ring->cq_ring_len = 0;
+  }
+
+  ring->sq_ring =
+      mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    goto fail;
+  }
+
+  void *cq = ring->sq_ring;
+  if (ring->cq_ring_len > 0) {
+    ring->cq_ring =
+        mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+      goto fail;
+    }
+    cq = ring->cq_ring;
+  }
+
+  ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    goto fail;
+  }
+
+  char *sq = ring->sq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)((char *)cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)((char *)cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)((char *)cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)cq + params.cq_off.cqes);
+
+  if (probe_ops(ring) != STATUS_SUCCESS) {
+    goto fail;
+  }
+  return STATUS_SUCCESS;
+
+fail:;
+  int saved_errno = errno;
+  uring_free(ring);
+  errno = saved_errno;
+  return STATUS_ERROR;
+}
+
+void uring_free(uring_t *ring) {
+  if (ring->sqes != MAP_FAILED) {
+    munmap(ring->sqes, ring->sqes_len);
+  }
+  if (ring->cq_ring != MAP_FAILED) {
+    munmap(ring->cq_ring, ring->cq_ring_len);
+  }
+  if (ring->sq_ring != MAP_FAILED) {
+    munmap(ring->sq_ring, ring->sq_ring_len);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  ring->sqes = MAP_FAILED;
+  ring->cq_ring = MAP_FAILED;
+  ring->sq_ring = MAP_FAILED;
+  ring->fd = -1;
+}
+
+int uring_register_eventfd(uring_t *ring, int fd) {
+  if (sys_register(ring->fd, IORING_REGISTER_EVENTFD, &fd, 1) == -1) {
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *ring->sq_tail + ring->queued;
+
+  if (tail - head > *ring->sq_mask) {
+    return NULL;
+  }
+
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  ring->queued++;
+  return sqe;
+}
+
+/* Publishes queued entries and, if wait is set, blocks until that many
+   completions are available. */
+int uring_submit(uring_t *ring, unsigned wait) {
+  unsigned submit = ring->queued;
+
+  if (submit > 0) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE);
+    ring->queued = 0;
+  }
+
+  while (submit > 0 || wait > 0) {
+    int n = sys_enter(ring->fd, submit, wait,
+                      wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return STATUS_ERROR;
+    }
+    if (n == 0 && submit > 0) {
+      errno = EBUSY;
+      return STATUS_ERROR;
+    }
+    submit -= (unsigned)n < submit ? (unsigned)n : submit;
+    wait = 0;
+  }
+  return STATUS_SUCCESS;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring) {
+  unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,877 @@
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "crc32.h"
+#include "file.h"
+#include "log.h"
+#include "metrics.h"
+#include "parse.h"
+#include "uring.h"
+#include "wal.h"
+
+#define WAL_URING_ENTRIES 8
+#define WAL_CQE_WRITE 1
+#define WAL_CQE_SYNC 2
+
+static uint32_t record_crc(uint16_t type, const void *payload, size_t len) {
+  uint16_t type_be = htons(type);
+  uint32_t crc = crc32_update(0, &type_be, sizeof(type_be));
+  return crc32_update(crc, payload, len);
+}
+
+static int write_full(int fd, const void *data, size_t size, off_t offset) {
+  const unsigned char *p = data;
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return STATUS_ERROR;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return STATUS_SUCCESS;
+}
+
+static int write_file_hdr(int fd, unsigned epoch) {
+  wal_file_hdr_t fhdr;
+  fhdr.magic = htonl(WAL_MAGIC);
+  fhdr.version = htons(WAL_VERSION);
+  fhdr.epoch = htons(epoch);
+  if (write_full(fd, &fhdr, sizeof(fhdr), 0) != STATUS_SUCCESS ||
+      fsync(fd) == -1) {
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+static char *suffixed_path(const char *path, const char *suffix) {
+  size_t path_len = strlen(path) + strlen(suffix) + 1;
+  char *out = malloc(path_len);
+  if (out != NULL) {
+    snprintf(out, path_len, "%s%s", path, suffix);
+  }
+  return out;
+}
+
+int parse_wal_sync(const char *arg, wal_sync_e *out) {
+  if (strcmp(arg, "always") == 0) {
+    *out = WAL_SYNC_ALWAYS;
+  } else if (strcmp(arg, "batch") == 0) {
+    *out = WAL_SYNC_BATCH;
+  } else if (strcmp(arg, "none") == 0) {
+    *out = WAL_SYNC_NONE;
+  } else {
+    return STATUS_ERROR;
+  }
+  return STATUS_SUCCESS;
+}
+
+/* A log created here starts from the given snapshot epoch; an existing one
+   keeps the epoch in its header. */
+int wal_open(const char *path, wal_sync_e sync, size_t checkpoint_bytes,
+             bool truncate, unsigned epoch, wal_t **walOut) {
+  wal_t *wal = calloc(1, sizeof(wal_t));
+  if (wal == NULL) {
+    log_error("Failed to allocate WAL: %m");
+    return STATUS_ERROR;
+  }
+
+  wal->path = strdup(path);
+  wal->rotated_path = suffixed_path(path, ".old");
+  if (wal->path == NULL || wal->rotated_path == NULL) {
+    log_error("Failed to allocate WAL path: %m");
+    free(wal->path);
+    free(wal->rotated_path);
+    free(wal);
+    return STATUS_ERROR;
+  }
+
+  wal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (wal->fd == -1) {
+    log_error("Failed to open WAL file: %m");
+    free(wal->path);
+    free(wal->rotated_path);
+    free(wal);
+    return STATUS_ERROR;
+  }
+  wal->sync = sync;
+  wal->checkpoint_bytes = checkpoint_bytes;
+  wal->next_batch = 1;
+  wal->event_fd = -1;
+  pthread_mutex_init(&wal->lock, NULL);
+  pthread_mutex_init(&wal->commit_lock, NULL);
+
+  struct stat walstat = {0};
+  if (truncate && ftruncate(wal->fd, 0) == -1) {
+    log_error("Failed to truncate WAL file: %m");
+    goto fail;
+  }
+  if (fstat(wal->fd, &walstat) == -1) {
+    log_error("Failed to get WAL file status: %m");
+    goto fail;
+  }
+
+  wal_file_hdr_t fhdr;
+  if (walstat.st_size == 0) {
+    if (write_file_hdr(wal->fd, epoch) != STATUS_SUCCESS) {
+      log_error("Failed to write WAL header: %m");
+      goto fail;
+    }
+    wal->version = WAL_VERSION;
+    wal->epoch = epoch;
+    wal->size = sizeof(fhdr);
+  } else {
+    if (pread(wal->fd, &fhdr, sizeof(fhdr), 0) != sizeof(fhdr) ||
+        ntohl(fhdr.magic) != WAL_MAGIC ||
+        (ntohs(fhdr.version) != 2 && ntohs(fhdr.version) != WAL_VERSION)) {
+      log_error("%s is not a valid write-ahead log", path);
+      goto fail;
+    }
+    wal->version = ntohs(fhdr.version);
+    wal->epoch = ntohs(fhdr.epoch) % EPOCH_COUNT;
+    wal->size = walstat.st_size;
+  }
+
+  *walOut = wal;
+  return STATUS_SUCCESS;
+
+fail:
+  close(wal->fd);
+  pthread_mutex_destroy(&wal->lock);
+  pthread_mutex_destroy(&wal->commit_lock);
+  free(wal->path);
+  free(wal->rotated_path);
+  free(wal);
+  return STATUS_ERROR;
+}
+
+void wal_close(wal_t *wal) {
+  if (wal == NULL)
+    return;
+  wal_commit(wal);
+  if (wal->ring != NULL) {
+    uring_free(wal->ring);
+    free(wal->ring);
+  }
+  if (wal->event_fd >= 0) {
+    close(wal->event_fd);
+  }
+  close(wal->fd);
+  pthread_mutex_destroy(&wal->lock);
+  pthread_mutex_destroy(&wal->commit_lock);
+  free(wal->buf);
+  free(wal->spare);
+  free(wal->waiters);
+  free(wal->path);
+  free(wal->rotated_path);
+  free(wal);
+}
+
+/* Version 2 logs carry fixed employee_t images; version 3 logs carry
+   hours, both string lengths and the string bytes. */
+static int decode_image(const wal_t *wal, const unsigned char *image,
+                        uint32_t len, wire_employee_t *out) {
+  if (wal->version == 2) {
+    const employee_t *employee = (const employee_t *)image;
+    if (len != sizeof(employee_t))
+      return STATUS_ERROR;
+    out->name = employee->name;
+    out->name_len = strnlen(employee->name, RECORD_STRING_MAX);
+    out->address = employee->address;
+    out->address_len = strnlen(employee->address, RECORD_STRING_MAX);
+    memcpy(&out->hours, &employee->hours, sizeof(out->hours));
+    out->hours = ntohl(out->hours);
+    return STATUS_SUCCESS;
+  }
+
+  uint32_t hours;
+  uint16_t lens[2];
+  if (len < sizeof(hours) + sizeof(lens))
+    return STATUS_ERROR;
+  memcpy(&hours, image, sizeof(hours));
+  memcpy(lens, image + sizeof(hours), sizeof(lens));
+  out->hours = ntohl(hours);
+  out->name_len = ntohs(lens[0]);
+  out->address_len = ntohs(lens[1]);
+  if (len != sizeof(hours) + sizeof(lens) + out->name_len + out->address_len)
+    return STATUS_ERROR;
+  out->name = (const char *)image + sizeof(hours) + sizeof(lens);
+  out->address = out->name + out->name_len;
+  if (memchr(out->name, '\0', out->name_len) != NULL ||
+      memchr(out->address, '\0', out->address_len) != NULL)
+    return STATUS_ERROR;
+  return STATUS_SUCCESS;
+}
+
+static int put_row(const wal_t *wal, database_t *db, uint64_t row,
+                   const unsigned char *image, uint32_t len) {
+  wire_employee_t employee;
+  dbrecord_t rec;
+
+  if (decode_image(wal, image, len, &employee) != STATUS_SUCCESS)
+    return STATUS_ERROR;
+
+  if (row >= db->capacity) {
+    size_t capacity = db->capacity ? db->capacity * 2 : EMPLOYEES_MIN_CAPACITY;
+    if (capacity < row + 1)
+      capacity = row + 1;
+    if (reserve_employees(db, capacity) != STATUS_SUCCESS)
+      return STATUS_ERROR;
+  }
+
+  if (make_record(db, employee.name, employee.name_len, employee.address,
+                  employee.address_len, employee.hours, &rec) != STATUS_SUCCESS)
+    return STATUS_ERROR;
+  db->records[row] = rec;
+  return STATUS_SUCCESS;
+}
+
+static int apply_record(const wal_t *wal, uint16_t type,
+                        const unsigned char *payload, uint32_t len,
+                        database_t *db) {
+  uint64_t row, new_count;
+  uint32_t hours;
+
+  if (len < sizeof(row))
+    return STATUS_ERROR;
+  memcpy(&row, payload, sizeof(row));
+  row = be64toh(row);
+  payload += sizeof(row);
+  len -= sizeof(row);
+
+  switch (type) {
+  case WAL_REC_ADD:
+    if (row != db->hdr->count)
+      return STATUS_ERROR;
+    if (put_row(wal, db, row, payload, len) != STATUS_SUCCESS)
+      return STATUS_ERROR;
+    db->hdr->count = row + 1;
+    return STATUS_SUCCESS;
+  case WAL_REC_UPDATE:
+    if (len != sizeof(hours) || row >= db->hdr->count)
+      return STATUS_ERROR;
+    memcpy(&hours, payload, sizeof(hours));
+    db->records[row].hours = ntohl(hours);
+    return STATUS_SUCCESS;
+  case WAL_REC_DELETE:
+    if (len < sizeof(new_count))
+      return STATUS_ERROR;
+    memcpy(&new_count, payload, sizeof(new_count));
+    new_count = be64toh(new_count);
+    payload += sizeof(new_count);
+    len -= sizeof(new_count);
+    if (new_count + 1 != db->hdr->count || row > new_count)
+      return STATUS_ERROR;
+    if (row < new_count &&
+        put_row(wal, db, row, payload, len) != STATUS_SUCCESS)
+      return STATUS_ERROR;
+    db->hdr->count = new_count;
+    return STATUS_SUCCESS;
+  default:
+    return STATUS_ERROR;
+  }
+}
+
+int wal_replay(wal_t *wal, database_t *db) {
+  size_t data_len = wal->size - sizeof(wal_file_hdr_t);
+  if (data_len == 0) {
+    return 0;
+  }
+
+  unsigned char *data = malloc(data_len);
+  if (data == NULL) {
+    log_error("Failed to allocate WAL replay buffer: %m");
+    return STATUS_ERROR;
+  }
+
+  ssize_t bytes_read = pread(wal->fd, data, data_len, sizeof(wal_file_hdr_t));
+  if (bytes_read == -1 || (size_t)bytes_read != data_len) {
+    log_error("Failed to read WAL file: %m");
+    free(data);
+    return STATUS_ERROR;
+  }
+
+  size_t off = 0;
+  int applied = 0;
+  while (off + sizeof(wal_rec_hdr_t) <= data_len) {
+    wal_rec_hdr_t rhdr;
+    memcpy(&rhdr, data + off, sizeof(rhdr));
+    uint32_t len = ntohl(rhdr.len);
+    uint16_t type = ntohs(rhdr.type);
+    const unsigned char *payload = data + off + sizeof(rhdr);
+
+    if (len > data_len - off - sizeof(rhdr) ||
+        record_crc(type, payload, len) != ntohl(rhdr.crc)) {
+      break;
+    }
+
+    /* Records address rows physically, so everything after one that does
+       not apply would land on the wrong rows. */
+    if (apply_record(wal, type, payload, len, db) != STATUS_SUCCESS) {
+      log_error("WAL record at %zu does not apply to the database file",
+                off + sizeof(wal_file_hdr_t));
+      free(data);
+      return STATUS_ERROR;
+    }
+    applied++;
+    off += sizeof(rhdr) + len;
+  }
+
+  free(data);
+
+  if (applied > 0) {
+    nameindex_free(&db->index);
+    if (nameindex_build(&db->index, db, db->hdr->count) !=
+        STATUS_SUCCESS) {
+      return STATUS_ERROR;
+    }
+  }
+
+  if (off != data_len) {
+    log_warn("Discarding %zu bytes of torn WAL tail after record %d",
+             data_len - off, applied);
+    wal->size = sizeof(wal_file_hdr_t) + off;
+    if (ftruncate(wal->fd, wal->size) == -1) {
+      log_error("Failed to truncate torn WAL tail: %m");
+      return STATUS_ERROR;
+    }
+  }
+
+  return applied;
+}
+
+static int wal_append(wal_t *wal, uint16_t type, const void *part1,
+                      size_t len1, const void *part2, size_t len2) {
+  size_t rec_len = sizeof(wal_rec_hdr_t) + len1 + len2;
+
+  if (wal_failed(wal)) {
+    log_error("Write-ahead log has failed, refusing changes");
+    return STATUS_ERROR;
+  }
+
+  pthread_mutex_lock(&wal->lock);
+
+  if (wal->len + rec_len > wal->cap) {
+    size_t new_cap = wal->cap ? wal->cap : 4096;
+    while (new_cap < wal->len + rec_len)
+      new_cap *= 2;
+    unsigned char *tmp = realloc(wal->buf, new_cap);
+    if (tmp == NULL) {
+      pthread_mutex_unlock(&wal->lock);
+      log_error("Failed to grow WAL buffer: %m");
+      return STATUS_ERROR;
+    }
+    wal->buf = tmp;
+    wal->cap = new_cap;
+  }
+
+  unsigned char *rec = wal->buf + wal->len;
+  unsigned char *payload = rec + sizeof(wal_rec_hdr_t);
+  memcpy(payload, part1, len1);
+  if (len2 > 0)
+    memcpy(payload + len1, part2, len2);
+
+  wal_rec_hdr_t rhdr;
+  rhdr.len = htonl(len1 + len2);
+  rhdr.crc = htonl(record_crc(type, payload, len1 + len2));
+  rhdr.type = htons(type);
+  rhdr.reserved = 0;
+  memcpy(rec, &rhdr, sizeof(rhdr));
+  wal->len += rec_len;
+  __atomic_add_fetch(&wal->records, 1, __ATOMIC_RELAXED);
+
+  pthread_mutex_unlock(&wal->lock);
+  return STATUS_SUCCESS;
+}
+
+static size_t encode_image(const database_t *db, const dbrecord_t *rec,
+                           unsigned char *out) {
+  uint32_t hours = htonl(rec->hours);
+  uint16_t lens[2] = {htons(rec->name_len), htons(rec->address_len)};
+  size_t n = 0;
+
+  memcpy(out + n, &hours, sizeof(hours));
+  n += sizeof(hours);
+  memcpy(out + n, lens, sizeof(lens));
+  n += sizeof(lens);
+  memcpy(out + n, record_name(db, rec), rec->name_len);
+  n += rec->name_len;
+  memcpy(out + n, record_address(db, rec), rec->address_len);
+  return n + rec->address_len;
+}
+
+int wal_log_add(wal_t *wal, uint64_t row, const database_t *db,
+                const dbrecord_t *rec) {
+  uint64_t row_be = htobe64(row);
+  unsigned char image[WAL_IMAGE_MAX];
+  return wal_append(wal, WAL_REC_ADD, &row_be, sizeof(row_be), image,
+                    encode_image(db, rec, image));
+}
+
+int wal_log_update(wal_t *wal, uint64_t row, unsigned int hours) {
+  uint64_t row_be = htobe64(row);
+  uint32_t hours_be = htonl(hours);
+  return wal_append(wal, WAL_REC_UPDATE, &row_be, sizeof(row_be), &hours_be,
+                    sizeof(hours_be));
+}
+
+int wal_log_delete(wal_t *wal, uint64_t row, uint64_t new_count,
+                   const database_t *db, const dbrecord_t *moved) {
+  uint64_t head[2] = {htobe64(row), htobe64(new_count)};
+  if (moved == NULL) {
+    return wal_append(wal, WAL_REC_DELETE, head, sizeof(head), NULL, 0);
+  }
+
+  unsigned char image[WAL_IMAGE_MAX];
+  return wal_append(wal, WAL_REC_DELETE, head, sizeof(head), image,
+                    encode_image(db, moved, image));
+}
+
+/* A batch that could not be made durable is never published as committed,
+   and nothing written after it could be replayed, so the log stops taking
+   records. Reactors close the clients still waiting on it. */
+static void fail_stop(wal_t *wal) {
+  log_error("Write-ahead log failed, no further changes will be accepted");
+  __atomic_store_n(&wal->failed, true, __ATOMIC_RELEASE);
+}
+
+/* Wakes only the reactors whose oldest waiting batch is now committed.
+   The caller holds commit_lock. The fence pairs with the one in
+   wal_watch(), so a reactor either sees the new committed batch or is
+   woken here. */
+static void notify_committed(wal_t *wal) {
+  uint64_t committed = __atomic_load_n(&wal->committed, __ATOMIC_ACQUIRE);
+  bool failed = wal_failed(wal);
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (size_t i = 0; i < wal->nwaiters; i++) {
+    uint64_t batch = __atomic_load_n(&wal->waiters[i]->batch,
+                                     __ATOMIC_RELAXED);
+    if (batch != 0 && (batch <= committed || failed)) {
+      eventfd_write(wal->waiters[i]->event_fd, 1);
+    }
+  }
+}
+
+static void drop_ring(wal_t *wal) {
+  uring_free(wal->ring);
+  free(wal->ring);
+  wal->ring = NULL;
+}
+
+/* The caller holds commit_lock, and only one batch is ever in flight, so
+   the ring always has room for its two entries. */
+static int queue_inflight(wal_t *wal) {
+  struct io_uring_sqe *sqe = uring_get_sqe(wal->ring);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = wal->fd;
+  sqe->addr = (uintptr_t)(wal->inflight + wal->inflight_done);
+  sqe->len = wal->inflight_len - wal->inflight_done;
+  sqe->off = wal->size + wal->inflight_done;
+  sqe->user_data = WAL_CQE_WRITE;
+  wal->inflight_cqes = 1;
+
+  if (wal->sync != WAL_SYNC_NONE) {
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = uring_get_sqe(wal->ring);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = wal->fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = WAL_CQE_SYNC;
+    wal->inflight_cqes = 2;
+  }
+
+  return uring_submit(wal->ring, 0);
+}
+
+static void finish_inflight(wal_t *wal) {
+  if (wal->inflight_error != 0) {
+    errno = wal->inflight_error;
+    log_error("Failed to append to WAL: %m");
+    fail_stop(wal);
+  } else {
+    wal->size += wal->inflight_len;
+  }
+  metrics_phase(METRIC_COMMIT, metrics_now() - wal->inflight_start);
+
+  pthread_mutex_lock(&wal->lock);
+  wal->spare = wal->inflight;
+  wal->spare_cap = wal->inflight_cap;
+  pthread_mutex_unlock(&wal->lock);
+
+  wal->inflight = NULL;
+  if (wal->inflight_error == 0) {
+    __atomic_store_n(&wal->committed, wal->inflight_batch, __ATOMIC_RELEASE);
+  }
+  notify_committed(wal);
+}
+
+/* Used once the ring has failed: the queued entries are never submitted
+   and the rest of the batch is written here. */
+static void complete_inflight_sync(wal_t *wal) {
+  log_error("io_uring submission failed, committing synchronously: %m");
+  drop_ring(wal);
+
+  if (write_full(wal->fd, wal->inflight + wal->inflight_done,
+                 wal->inflight_len - wal->inflight_done,
+                 wal->size + wal->inflight_done) != STATUS_SUCCESS ||
+      (wal->sync != WAL_SYNC_NONE && fdatasync(wal->fd) == -1)) {
+    wal->inflight_error = errno;
+  }
+  finish_inflight(wal);
+}
+
+static void start_batch(wal_t *wal) {
+  pthread_mutex_lock(&wal->lock);
+  if (wal->len == 0 || wal_failed(wal)) {
+    pthread_mutex_unlock(&wal->lock);
+    return;
+  }
+  wal->inflight = wal->buf;
+  wal->inflight_len = wal->len;
+  wal->inflight_cap = wal->cap;
+  wal->inflight_batch = wal->next_batch++;
+  wal->buf = wal->spare;
+  wal->cap = wal->spare_cap;
+  wal->spare = NULL;
+  wal->spare_cap = 0;
+  wal->len = 0;
+  pthread_mutex_unlock(&wal->lock);
+
+  wal->inflight_done = 0;
+  wal->inflight_error = 0;
+  wal->inflight_start = metrics_now();
+  if (queue_inflight(wal) != STATUS_SUCCESS) {
+    complete_inflight_sync(wal);
+  }
+}
+
+static void reap_inflight(wal_t *wal) {
+  struct io_uring_cqe *cqe;
+
+  while (wal->inflight != NULL &&
+         (cqe = uring_peek_cqe(wal->ring)) != NULL) {
+    int res = cqe->res;
+    uint64_t tag = cqe->user_data;
+    uring_cqe_seen(wal->ring);
+    wal->inflight_cqes--;
+
+    if (tag == WAL_CQE_WRITE) {
+      if (res < 0) {
+        wal->inflight_error = -res;
+      } else if (res == 0) {
+        wal->inflight_error = EIO;
+      } else {
+        wal->inflight_done += res;
+      }
+    } else if (res < 0 && res != -ECANCELED) {
+      wal->inflight_error = -res;
+    }
+
+    if (wal->inflight_cqes > 0) {
+      continue;
+    }
+    /* A short write cancels the linked fsync; queue both again for the
+       rest of the batch. */
+    if (wal->inflight_error == 0 && wal->inflight_done < wal->inflight_len) {
+      if (queue_inflight(wal) != STATUS_SUCCESS) {
+        complete_inflight_sync(wal);
+      }
+      continue;
+    }
+    finish_inflight(wal);
+  }
+}
+
+static void wait_inflight(wal_t *wal) {
+  while (wal->inflight != NULL) {
+    reap_inflight(wal);
+    if (wal->inflight == NULL) {
+      break;
+    }
+    if (uring_submit(wal->ring, 1) != STATUS_SUCCESS) {
+      log_error("Failed to wait for WAL write: %m");
+      return;
+    }
+  }
+}
+
+int wal_enable_uring(wal_t *wal) {
+  uring_t *ring = malloc(sizeof(uring_t));
+  if (ring == NULL) {
+    log_error("Failed to allocate io_uring: %m");
+    return STATUS_ERROR;
+  }
+
+  if (uring_init(ring, WAL_URING_ENTRIES) != STATUS_SUCCESS) {
+    log_warn("io_uring is unavailable, committing synchronously: %m");
+    free(ring);
+    return STATUS_ERROR;
+  }
+
+  int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd == -1 ||
+      uring_register_eventfd(ring, event_fd) != STATUS_SUCCESS) {
+    log_warn("io_uring eventfd is unavailable, committing synchronously: %m");
+    if (event_fd >= 0) {
+      close(event_fd);
+    }
+    uring_free(ring);
+    free(ring);
+    return STATUS_ERROR;
+  }
+
+  wal->ring = ring;
+  wal->event_fd = event_fd;
+  return STATUS_SUCCESS;
+}
+
+/* Starts writing the buffered records if no batch is in flight and returns
+   the batch that covers every record logged so far. Without a ring this
+   commits synchronously. */
+uint64_t wal_submit(wal_t *wal) {
+  pthread_mutex_lock(&wal->commit_lock);
+  pthread_mutex_lock(&wal->lock);
+  uint64_t target = wal->len > 0 ? wal->next_batch : wal->next_batch - 1;
+  pthread_mutex_unlock(&wal->lock);
+
+  if (wal->ring == NULL) {
+    pthread_mutex_unlock(&wal->commit_lock);
+    wal_commit(wal);
+    return target;
+  }
+
+  if (wal->inflight == NULL) {
+    start_batch(wal);
+  }
+  pthread_mutex_unlock(&wal->commit_lock);
+  return target;
+}
+
+void wal_reap(wal_t *wal) {
+  pthread_mutex_lock(&wal->commit_lock);
+  if (wal->ring != NULL) {
+    reap_inflight(wal);
+    if (wal->inflight == NULL) {
+      start_batch(wal);
+    }
+  }
+  pthread_mutex_unlock(&wal->commit_lock);
+}
+
+uint64_t wal_committed(wal_t *wal) {
+  return __atomic_load_n(&wal->committed, __ATOMIC_ACQUIRE);
+}
+
+bool wal_failed(wal_t *wal) {
+  return __atomic_load_n(&wal->failed, __ATOMIC_ACQUIRE);
+}
+
+int wal_add_waiter(wal_t *wal, wal_waiter_t *waiter) {
+  pthread_mutex_lock(&wal->commit_lock);
+  wal_waiter_t **tmp =
+      realloc(wal->waiters, (wal->nwaiters + 1) * sizeof(wal_waiter_t *));
+  if (tmp == NULL) {
+    pthread_mutex_unlock(&wal->commit_lock);
+    log_error("Failed to register commit waiter: %m");
+    return STATUS_ERROR;
+  }
+  wal->waiters = tmp;
+  wal->waiters[wal->nwaiters++] = waiter;
+  pthread_mutex_unlock(&wal->commit_lock);
+  return STATUS_SUCCESS;
+}
+
+void wal_remove_waiter(wal_t *wal, wal_waiter_t *waiter) {
+  pthread_mutex_lock(&wal->commit_lock);
+  for (size_t i = 0; i < wal->nwaiters; i++) {
+    if (wal->waiters[i] == waiter) {
+      wal->waiters[i] = wal->waiters[--wal->nwaiters];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&wal->commit_lock);
+}
+
+/* Publishes the oldest batch the reactor waits on, 0 for none. Returns
+   true if it has already committed, or the log has failed, so the caller
+   must not wait for a wakeup. */
+bool wal_watch(wal_t *wal, wal_waiter_t *waiter, uint64_t batch) {
+  __atomic_store_n(&waiter->batch, batch, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  return batch != 0 && (batch <= wal_committed(wal) || wal_failed(wal));
+}
+
+int wal_commit(wal_t *wal) {
+  pthread_mutex_lock(&wal->commit_lock);
+  if (wal->ring != NULL) {
+    wait_inflight(wal);
+  }
+
+  pthread_mutex_lock(&wal->lock);
+  if (wal->len == 0 || wal_failed(wal)) {
+    pthread_mutex_unlock(&wal->lock);
+    pthread_mutex_unlock(&wal->commit_lock);
+    return wal_failed(wal) ? STATUS_ERROR : STATUS_SUCCESS;
+  }
+  unsigned char *batch_buf = wal->buf;
+  size_t batch_len = wal->len;
+  size_t batch_cap = wal->cap;
+  wal->buf = wal->spare;
+  wal->cap = wal->spare_cap;
+  wal->len = 0;
+  uint64_t batch = wal->next_batch++;
+  pthread_mutex_unlock(&wal->lock);
+
+  uint64_t start = metrics_now();
+  int ret = STATUS_SUCCESS;
+  if (write_full(wal->fd, batch_buf, batch_len, wal->size) !=
+      STATUS_SUCCESS) {
+    log_error("Failed to append to WAL: %m");
+    ret = STATUS_ERROR;
+  } else if (wal->sync != WAL_SYNC_NONE && fdatasync(wal->fd) == -1) {
+    log_error("Failed to sync WAL: %m");
+    ret = STATUS_ERROR;
+  }
+  if (ret == STATUS_SUCCESS) {
+    wal->size += batch_len;
+  } else {
+    fail_stop(wal);
+  }
+  metrics_phase(METRIC_COMMIT, metrics_now() - start);
+
+  pthread_mutex_lock(&wal->lock);
+  wal->spare = batch_buf;
+  wal->spare_cap = batch_cap;
+  pthread_mutex_unlock(&wal->lock);
+
+  if (ret == STATUS_SUCCESS) {
+    __atomic_store_n(&wal->committed, batch, __ATOMIC_RELEASE);
+  }
+  notify_committed(wal);
+  pthread_mutex_unlock(&wal->commit_lock);
+  return ret;
+}
+
+/* Empties the log once the database file has been written with the given
+   epoch. */
+int wal_reset(wal_t *wal, unsigned epoch) {
+  int ret = STATUS_SUCCESS;
+
+  pthread_mutex_lock(&wal->commit_lock);
+  if (wal->ring != NULL) {
+    wait_inflight(wal);
+  }
+  pthread_mutex_lock(&wal->lock);
+
+  if (ftruncate(wal->fd, sizeof(wal_file_hdr_t)) == -1 ||
+      write_file_hdr(wal->fd, epoch) != STATUS_SUCCESS) {
+    log_error("Failed to truncate WAL after checkpoint: %m");
+    ret = STATUS_ERROR;
+  } else {
+    wal->version = WAL_VERSION;
+    wal->epoch = epoch % EPOCH_COUNT;
+    wal->size = sizeof(wal_file_hdr_t);
+    __atomic_store_n(&wal->records, 0, __ATOMIC_RELAXED);
+    /* Buffered records are already in the checkpoint. */
+    if (wal->len > 0) {
+      __atomic_store_n(&wal->committed, wal->next_batch++, __ATOMIC_RELEASE);
+    }
+    wal->len = 0;
+  }
+
+  pthread_mutex_unlock(&wal->lock);
+  notify_committed(wal);
+  pthread_mutex_unlock(&wal->commit_lock);
+  return ret;
+}
+
+/* Commits what is buffered, moves the log aside to <path>.old and carries
+   on in an empty one for the next epoch, which a snapshot of the current
+   state will be written with. The caller keeps appends out until then. */
+int wal_rotate(wal_t *wal) {
+  if (wal_commit(wal) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+
+  char *next_path = suffixed_path(wal->path, ".next");
+  if (next_path == NULL) {
+    log_error("Failed to allocate WAL path: %m");
+    return STATUS_ERROR;
+  }
+
+  unsigned epoch = (wal->epoch + 1) % EPOCH_COUNT;
+  int fd = open(next_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1 || write_file_hdr(fd, epoch) != STATUS_SUCCESS) {
+    log_error("Failed to start a new WAL segment: %m");
+    goto fail;
+  }
+  if (replace_file(wal->path, wal->rotated_path) != STATUS_SUCCESS) {
+    goto fail;
+  }
+  if (replace_file(next_path, wal->path) != STATUS_SUCCESS) {
+    replace_file(wal->rotated_path, wal->path);
+    goto fail;
+  }
+  free(next_path);
+
+  pthread_mutex_lock(&wal->commit_lock);
+  if (wal->ring != NULL) {
+    wait_inflight(wal);
+  }
+  pthread_mutex_lock(&wal->lock);
+  close(wal->fd);
+  wal->fd = fd;
+  wal->version = WAL_VERSION;
+  wal->epoch = epoch;
+  wal->size = sizeof(wal_file_hdr_t);
+  wal->rotated = true;
+  __atomic_store_n(&wal->records, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&wal->lock);
+  pthread_mutex_unlock(&wal->commit_lock);
+  return STATUS_SUCCESS;
+
+fail:
+  if (fd != -1) {
+    close(fd);
+    unlink(next_path);
+  }
+  free(next_path);
+  return STATUS_ERROR;
+}
+
+/* Called once a snapshot covering the rotated segment is on disk. */
+int wal_drop_rotated(wal_t *wal) {
+  if (!wal->rotated) {
+    return STATUS_SUCCESS;
+  }
+  if (remove_file(wal->rotated_path) != STATUS_SUCCESS) {
+    return STATUS_ERROR;
+  }
+  wal->rotated = false;
+  return STATUS_SUCCESS;
+}
+
+/* Records appended since the last checkpoint or rotation. */
+uint64_t wal_changes(wal_t *wal) {
+  return __atomic_load_n(&wal->records, __ATOMIC_RELAXED);
+}
+
+bool wal_needs_checkpoint(wal_t *wal) {
+  return wal->checkpoint_bytes > 0 && wal->size >= wal->checkpoint_bytes;
+}